@@ -0,0 +1,423 @@
+// Timing of Trie::insert, DenseTrie::pack, match and scan:
+//     TrieBench [repetitions] [numKeys] [hitRatio]
+// numKeys sizes the synthetic datasets (default 100000), hitRatio the throughput query mix.
+// With hardware counters (TRIE_PERF_COUNTERS, Linux) pack, lookups and scan get an extra line
+//     <dataset> <metric> cycles <v> instructions <v> l1d-miss <v> llc-miss <v> dtlb-miss <v> branch-miss <v> per op
+// The "huge" metrics repeat lookups on the image moved to 2 MiB pages; their dTLB misses drop
+// once the image spans many pages, e.g. TrieBench 5 5000000.
+// Every metric is measured `repetitions` times and printed as one line
+//     <dataset> <metric> median <v> p90 <v> p99 <v> min <v> <unit>
+// so runs can be diffed or gated by a script.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib> // atoi, strtoull
+#include <random>
+#include <string>
+
+#include "datasets.h"
+#include "multi_trie.h"
+#include "perf_counters.h"
+#include "persistent_trie.h"
+#include "trie.h"
+#include "words.h"
+
+struct Dataset {
+    std::string name;
+    KeySet keys;
+};
+
+static volatile size_t g_sink; // keeps results alive
+static PerfCounters* g_counters; // null if no counter could be opened
+
+static double nowNs()
+{
+    using namespace std::chrono;
+    return (double)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static Dataset fromList(const char* name, const char** begin, const char** end)
+{
+    Dataset dataset { name, {} };
+    for (auto it = begin; it != end; ++it)
+        dataset.keys.add(*it);
+    return dataset;
+}
+
+// keys with the last char replaced, they fail at the deepest node
+static KeySet prefixMisses(const KeySet& queries)
+{
+    KeySet result;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        std::string query = queries[i];
+        query.back() = missChar;
+        result.add(query);
+    }
+    return result;
+}
+
+// keys and noise words separated by spaces and punctuation
+static std::string makeText(const Dataset& dataset, size_t numWords, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::string text;
+    for (size_t i = 0; i < numWords; ++i) {
+        if (rng() % 2) {
+            text += dataset.keys[rng() % dataset.keys.size()];
+        } else {
+            for (size_t len = 2 + rng() % 9; len; --len)
+                text += char('a' + rng() % 26);
+        }
+        text += (rng() % 8) ? " " : ", ";
+    }
+    return text;
+}
+
+static void report(const char* dataset, const char* metric, std::vector<double> samples, const char* unit)
+{
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) { return samples[std::min(samples.size() - 1, size_t(p * samples.size()))]; };
+    printf("%-10s %-22s median %10.2f p90 %10.2f p99 %10.2f min %10.2f %s\n", dataset, metric,
+        percentile(0.5), percentile(0.9), percentile(0.99), samples.front(), unit);
+}
+
+template <typename Fn>
+static std::vector<double> measure(int repetitions, Fn&& fn)
+{
+    std::vector<double> samples;
+    for (int r = 0; r < repetitions; ++r) {
+        const double start = nowNs();
+        fn();
+        samples.push_back(nowNs() - start);
+    }
+    return samples;
+}
+
+static std::vector<double> scaled(std::vector<double> samples, double scale)
+{
+    for (auto& s : samples)
+        s *= scale;
+    return samples;
+}
+
+// one more run of fn with hardware counters, printed per operation
+template <typename Fn>
+static void count(const char* dataset, const char* metric, double numOps, Fn&& fn)
+{
+    if (!g_counters)
+        return;
+    g_counters->start();
+    fn();
+    g_counters->stop();
+    printf("%-10s %-22s", dataset, metric);
+    g_counters->print(stdout, numOps);
+    printf(" per op\n");
+}
+
+// each lookup depends on the previous result, so the time is latency rather than throughput
+static void benchLatency(const char* dataset, const char* metric, const DenseTrie& dtrie,
+    const KeySet& queries, int repetitions)
+{
+    auto lookups = [&] {
+        size_t index = 0;
+        for (size_t i = 0; i < queries.size(); ++i)
+            index = (index + 1 + (dtrie.match(queries[index]) & 1)) % queries.size();
+        g_sink = index;
+    };
+    report(dataset, metric, scaled(measure(repetitions, lookups), 1.0 / queries.size()), "ns/lookup");
+    count(dataset, metric, queries.size(), lookups);
+}
+
+// independent lookups of every query, int match(const char* query), so the time is throughput
+template <typename Match>
+static void benchThroughput(const char* dataset, const char* metric, const KeySet& queries, int repetitions,
+    Match&& match)
+{
+    auto lookups = [&] {
+        size_t sum = 0;
+        for (size_t i = 0; i < queries.size(); ++i)
+            sum += match(queries[i]);
+        g_sink = sum;
+    };
+    report(dataset, metric, scaled(measure(repetitions, lookups), 1.0 / queries.size()), "ns/lookup");
+    count(dataset, metric, queries.size(), lookups);
+}
+
+static void benchDataset(const Dataset& dataset, double hitRatio, int repetitions)
+{
+    const char* name = dataset.name.c_str();
+    const KeySet& keys = dataset.keys;
+
+    const auto insertSamples = measure(repetitions, [&] {
+        Trie trie;
+        for (size_t i = 0; i < keys.size(); ++i)
+            trie.insert(keys[i]);
+    });
+    report(name, "insert", scaled(insertSamples, 1.0 / keys.size()), "ns/key");
+
+    // path copying, every insert is a new version
+    const auto cowSamples = measure(repetitions, [&] {
+        PersistentTrie persistent;
+        for (size_t i = 0; i < keys.size(); ++i)
+            persistent.insert(keys[i]);
+    });
+    report(name, "cow insert", scaled(cowSamples, 1.0 / keys.size()), "ns/key");
+
+    // keys are shuffled, so scores by position are random popularities
+    Trie trie;
+    for (size_t i = 0; i < keys.size(); ++i)
+        trie.insert(keys[i], ScoreType(keys.size() - i));
+
+    // incremental maintenance: drop a key and add it back, trie is unchanged afterwards
+    auto churn = [&] {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            trie.erase(keys[i]);
+            trie.insert(keys[i], ScoreType(keys.size() - i));
+        }
+    };
+    report(name, "erase+insert", scaled(measure(repetitions, churn), 1.0 / keys.size()), "ns/key");
+
+    DenseTrie dtrie;
+    auto pack = [&] { dtrie.pack(trie.root); };
+    report(name, "pack", scaled(measure(repetitions, pack), 1.0 / keys.size()), "ns/key");
+    count(name, "pack", keys.size(), pack);
+    // delta pack after 100 score changes, the image grows by the rewritten paths
+    DenseTrie delta;
+    delta.pack(trie.root, PackScores);
+    size_t changed = 0;
+    auto repack = [&] {
+        for (int n = 0; n < 100; ++n, ++changed)
+            trie.update(keys[changed * 7919 % keys.size()], ScoreType(changed));
+        delta.repack(trie.root);
+    };
+    report(name, "repack 100", scaled(measure(repetitions, repack), 1.0 / 100), "ns/change");
+    printf("%-10s %-22s %zu image bytes, %zu garbage bytes\n", name, "repack size", delta.data().size(), delta.garbageBytes());
+    const TrieStats trieStats = trie.stats(), denseStats = dtrie.stats();
+    printf("%-10s %-22s %zu keys, %zu key bytes, %zu trie bytes, %zu image bytes, %.2f bytes/key\n", name, "size",
+        keys.size(), keys.keyBytes(), trieStats.totalBytes(), dtrie.data().size(), (double)dtrie.data().size() / keys.size());
+    printf("%-10s %-22s ", name, "trie stats");
+    trieStats.print(stdout);
+    printf("%-10s %-22s ", name, "dense stats");
+    denseStats.print(stdout);
+
+    // a base dictionary and overrides sharing half of their keys
+    Trie baseTrie, overrideTrie;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 4 != 3)
+            baseTrie.insert(keys[i]);
+        if (i % 4 >= 2)
+            overrideTrie.insert(keys[i]);
+    }
+    DenseTrie base, overrides, combined;
+    base.pack(baseTrie.root);
+    overrides.pack(overrideTrie.root);
+    for (auto [op, metric] : { std::pair { SetOperation::Union, "union" }, { SetOperation::Intersection, "intersection" },
+             { SetOperation::Difference, "difference" } }) {
+        auto combine = [&, op = op] { combined.combine(base, overrides, op); };
+        report(name, metric, scaled(measure(repetitions, combine), 1.0 / keys.size()), "ns/key");
+    }
+
+    // 200 small tenants, each with a slice of up to 500 keys and the same 100 common ones
+    const size_t numTenants = 200;
+    const size_t tenantSlice = std::min<size_t>(keys.size(), numTenants * 500);
+    std::vector<Trie> tenantTries(numTenants);
+    std::vector<const TrieNode*> tenantRoots;
+    size_t tenantBytes = 0, tenantKeys = 0;
+    for (size_t t = 0; t < numTenants; ++t) {
+        for (size_t i = t; i < tenantSlice; i += numTenants, ++tenantKeys)
+            tenantTries[t].insert(keys[i]);
+        for (size_t i = 0; i < std::min<size_t>(100, keys.size()); ++i, ++tenantKeys)
+            tenantTries[t].insert(keys[i]);
+        DenseTrie single;
+        single.pack(tenantTries[t].root);
+        tenantBytes += single.data().size();
+        tenantRoots.push_back(&tenantTries[t].root);
+    }
+    MultiDenseTrie tenants;
+    auto packTenants = [&] { tenants.pack(tenantRoots); };
+    report(name, "pack tenants", scaled(measure(repetitions, packTenants), 1.0 / tenantKeys), "ns/key");
+    printf("%-10s %-22s %zu separate image bytes, %zu shared image bytes\n", name, "tenants size", tenantBytes,
+        tenants.data().size());
+
+    const size_t numQueries = std::clamp<size_t>(keys.size(), 10000, 1000000);
+    const KeySet hits = generateQueries(keys, numQueries, 1.0, 1.0, 42);
+    benchLatency(name, "latency hit", dtrie, hits, repetitions);
+    benchLatency(name, "latency miss", dtrie, generateQueries(keys, numQueries, 0.0, 1.0, 43), repetitions);
+    benchLatency(name, "latency prefix-miss", dtrie, prefixMisses(hits), repetitions);
+
+    const KeySet batch = generateQueries(keys, numQueries, hitRatio, 1.0, 44);
+    benchThroughput(name, "throughput", batch, repetitions, [&](const char* query) { return dtrie.match(query); });
+
+    // 64-bit offsets, the layout images past 4 GiB need
+    WideDenseTrie wide;
+    wide.pack(trie.root);
+    benchThroughput(name, "throughput wide", batch, repetitions, [&](const char* query) { return wide.match(query); });
+    printf("%-10s %-22s %zu image bytes\n", name, "wide size", wide.data().size());
+
+    // the same image on huge pages
+    DenseTrie huge = dtrie;
+    huge.useHugePages(true);
+    benchThroughput(name, "throughput huge", batch, repetitions, [&](const char* query) { return huge.match(query); });
+    benchLatency(name, "latency hit huge", huge, hits, repetitions);
+
+    // queries round-robin over the tenants
+    benchThroughput(name, "throughput tenants", batch, repetitions, [&, tenant = size_t(0)](const char* query) mutable {
+        return tenants.match(tenant++ % numTenants, query);
+    });
+
+    // case-insensitive: the same mix in uppercase against a folded trie
+    Trie foldedTrie(true);
+    for (size_t i = 0; i < keys.size(); ++i)
+        foldedTrie.insert(keys[i]);
+    DenseTrie folded;
+    folded.pack(foldedTrie.root, PackFoldCase);
+    KeySet upperBatch;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        std::string query = batch[i];
+        for (auto& c : query)
+            c = (char)toupper((unsigned char)c);
+        upperBatch.add(query);
+    }
+    benchThroughput(name, "throughput fold", upperBatch, repetitions, [&](const char* query) { return folded.match(query); });
+
+#ifdef TRIE_NODE_STATS
+    dtrie.resetNodeStats();
+    for (size_t i = 0; i < batch.size(); ++i)
+        g_sink = dtrie.match(batch[i]);
+    printf("%-10s node heatmap of one throughput run\n", name);
+    dtrie.dumpHeatmap(stdout, 20);
+#endif
+
+    // typeahead: the 10 first completions of 2-char prefixes of popular keys
+    KeySet prefixes;
+    for (size_t i = 0; i < hits.size(); ++i)
+        prefixes.add(std::string_view(hits[i]).substr(0, 2));
+    auto completions = [&] {
+        char buffer[256];
+        size_t found = 0;
+        for (size_t i = 0; i < prefixes.size(); ++i)
+            found += dtrie.complete(prefixes[i], buffer, sizeof(buffer), 10, [](const char*, size_t) {});
+        g_sink = found;
+    };
+    report(name, "complete 10", scaled(measure(repetitions, completions), 1.0 / prefixes.size()), "ns/query");
+    count(name, "complete 10", prefixes.size(), completions);
+
+    DenseTrie scored;
+    scored.pack(trie.root, PackScores);
+    auto topCompletions = [&] {
+        char buffer[256];
+        size_t found = 0;
+        for (size_t i = 0; i < prefixes.size(); ++i)
+            found += scored.topK(prefixes[i], buffer, sizeof(buffer), 10, [](const char*, size_t, ScoreType) {});
+        g_sink = found;
+    };
+    report(name, "top 10", scaled(measure(repetitions, topCompletions), 1.0 / prefixes.size()), "ns/query");
+    count(name, "top 10", prefixes.size(), topCompletions);
+
+    // spelling correction: keys with one char replaced, edit distance 1
+    const KeySet misspelled = generateQueries(keys, 1000, 0.0, 1.0, 45);
+    auto corrections = [&] {
+        char buffer[256];
+        size_t found = 0;
+        for (size_t i = 0; i < misspelled.size(); ++i)
+            found += dtrie.fuzzy(misspelled[i], 1, buffer, sizeof(buffer), [](const char*, size_t, int) {});
+        g_sink = found;
+    };
+    report(name, "fuzzy 1", scaled(measure(repetitions, corrections), 1.0 / misspelled.size()), "ns/query");
+    count(name, "fuzzy 1", misspelled.size(), corrections);
+
+    // ordered set use: seek to a key and read the next 100
+    auto rangeScans = [&] {
+        size_t bytes = 0;
+        for (size_t i = 0; i < misspelled.size(); ++i) {
+            auto it = dtrie.lowerBound(misspelled[i]);
+            for (int n = 0; n < 100 && it.valid(); ++n, ++it)
+                bytes += it->size();
+        }
+        g_sink = bytes;
+    };
+    report(name, "range 100", scaled(measure(repetitions, rangeScans), 1.0 / misspelled.size()), "ns/query");
+    count(name, "range 100", misspelled.size(), rangeScans);
+
+    // dictionary encoding: key to dense id and back
+    DenseTrie ranked;
+    ranked.pack(trie.root, PackCounts);
+    auto encode = [&] {
+        size_t sum = 0;
+        for (size_t i = 0; i < hits.size(); ++i)
+            sum += ranked.idOf(hits[i]);
+        g_sink = sum;
+    };
+    report(name, "id of", scaled(measure(repetitions, encode), 1.0 / hits.size()), "ns/lookup");
+    count(name, "id of", hits.size(), encode);
+    auto decode = [&] {
+        char buffer[256];
+        size_t bytes = 0;
+        for (size_t i = 0; i < hits.size(); ++i)
+            bytes += ranked.keyOf(i % keys.size(), buffer, sizeof(buffer));
+        g_sink = bytes;
+    };
+    report(name, "key of", scaled(measure(repetitions, decode), 1.0 / hits.size()), "ns/lookup");
+    count(name, "key of", hits.size(), decode);
+
+    const std::string text = makeText(dataset, 100000, 7);
+    auto scan = [&] {
+        size_t found = 0;
+        dtrie.scan(text.c_str(), [&](size_t, int) { found++; });
+        g_sink = found;
+    };
+    std::vector<double> scanSpeed;
+    for (double ns : measure(repetitions, scan))
+        scanSpeed.push_back(text.size() * 1e3 / ns); // bytes/ns -> MB/s
+    report(name, "scan", scanSpeed, "MB/s");
+    count(name, "scan (per byte)", text.size(), scan);
+
+    // ASCII text over a UTF-8 image: one SSE2 pass, then the byte scan
+    DenseTrie utf8;
+    utf8.pack(trie.root, PackUtf8);
+    auto utf8Scan = [&] {
+        size_t found = 0;
+        utf8.scan(text.c_str(), [&](size_t, int) { found++; });
+        g_sink = found;
+    };
+    std::vector<double> utf8Speed;
+    for (double ns : measure(repetitions, utf8Scan))
+        utf8Speed.push_back(text.size() * 1e3 / ns);
+    report(name, "scan utf8", utf8Speed, "MB/s");
+
+    // the same text arriving in packets of a TCP payload size
+    auto streamScan = [&] {
+        size_t found = 0;
+        auto onMatch = [&](size_t, int) { found++; };
+        DenseTrie::StreamScanner scanner = dtrie.streamScanner();
+        for (size_t pos = 0; pos < text.size(); pos += 1460)
+            scanner.feed(text.data() + pos, std::min<size_t>(1460, text.size() - pos), onMatch);
+        scanner.finish(onMatch);
+        g_sink = found;
+    };
+    std::vector<double> streamSpeed;
+    for (double ns : measure(repetitions, streamScan))
+        streamSpeed.push_back(text.size() * 1e3 / ns);
+    report(name, "scan stream", streamSpeed, "MB/s");
+    count(name, "scan stream (per byte)", text.size(), streamScan);
+}
+
+int main(int argc, char** argv)
+{
+    const int repetitions = argc > 1 ? std::max(1, atoi(argv[1])) : 15;
+    const size_t numKeys = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000;
+    const double hitRatio = argc > 3 ? atof(argv[3]) : 0.5;
+
+    PerfCounters counters;
+    if (counters.anyAvailable())
+        g_counters = &counters;
+    else
+        printf("hardware counters unavailable\n");
+
+    benchDataset(fromList("words10000", Words10000::begin(), Words10000::end()), hitRatio, repetitions);
+    benchDataset(fromList("fruits", WordsFruits::begin(), WordsFruits::end()), hitRatio, repetitions);
+
+    for (DatasetKind kind : { DatasetKind::NaturalWords, DatasetKind::UrlPaths, DatasetKind::BinaryKeys,
+             DatasetKind::Ipv4Prefixes, DatasetKind::Ipv6Prefixes, DatasetKind::Identifiers })
+        benchDataset({ datasetName(kind), generateDataset(kind, numKeys, 1) }, hitRatio, repetitions);
+    return 0;
+}
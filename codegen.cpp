@@ -0,0 +1,137 @@
+// Emits a C++ source file with a switch-based matcher for a fixed word list,
+// returning the same lengths as DenseTrie::match:
+//     TrieCodegen <words.txt | fruits | words10000> <functionName> <output.cpp>
+#include <string>
+
+#include "trie.h"
+#include "words.h"
+
+static void printKey(FILE* out, char c)
+{
+    if (c >= ' ' && c <= '~' && c != '\'' && c != '\\')
+        fprintf(out, "'%c'", c);
+    else
+        fprintf(out, "%d", c);
+}
+
+static void indent(FILE* out, int level) { fprintf(out, "%*s", level * 4, ""); }
+
+// text[depth] selects one of node's children; a NUL never matches a key and
+// && stops at the first mismatch, so the code never reads past the end of the text
+static void emitNode(FILE* out, const TrieNode& node, int depth, int level)
+{
+    // child is reached by text[childDepth - 1]
+    auto emitChild = [&](const TrieNode& child, int childDepth, int childLevel) {
+        if (child.getSize() == 0) {
+            indent(out, childLevel);
+            fprintf(out, "return %d;\n", childDepth);
+            return;
+        }
+        if (child.bStop) {
+            indent(out, childLevel);
+            fprintf(out, "lenEnd = %d;\n", childDepth);
+        }
+        emitNode(out, child, childDepth, childLevel);
+    };
+
+    if (node.getSize() == 1) {
+        // fold a chain of single-child nodes into one compare
+        indent(out, level);
+        fprintf(out, "if (");
+        const TrieNode* chain = &node;
+        int chainDepth = depth;
+        while (true) {
+            fprintf(out, "text[%d] == ", chainDepth);
+            printKey(out, chain->getKey(0));
+            const TrieNode* next = chain->getNode(0);
+            if (next->getSize() != 1 || next->bStop)
+                break;
+            fprintf(out, " && ");
+            chain = next;
+            chainDepth++;
+        }
+        fprintf(out, ") {\n");
+        emitChild(*chain->getNode(0), chainDepth + 1, level + 1);
+        indent(out, level);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    indent(out, level);
+    fprintf(out, "switch (text[%d]) {\n", depth);
+    for (const auto& [c, child] : node.children) {
+        indent(out, level);
+        fprintf(out, "case ");
+        printKey(out, c);
+        fprintf(out, ":\n");
+        emitChild(*child, depth + 1, level + 1);
+        if (child->getSize() != 0) {
+            indent(out, level + 1);
+            fprintf(out, "break;\n");
+        }
+    }
+    indent(out, level);
+    fprintf(out, "}\n");
+}
+
+static bool readWords(const char* path, Trie& trie)
+{
+    FILE* in = fopen(path, "rb");
+    if (!in)
+        return false;
+
+    std::string word;
+    for (int c; (c = fgetc(in)) != EOF;) {
+        if (c == '\n' || c == '\r') {
+            if (!word.empty())
+                trie.insert(word.c_str());
+            word.clear();
+        } else {
+            word += char(c);
+        }
+    }
+    if (!word.empty())
+        trie.insert(word.c_str());
+    fclose(in);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <words.txt | fruits | words10000> <functionName> <output.cpp>\n", argv[0]);
+        return 1;
+    }
+    const char* source = argv[1];
+    const char* functionName = argv[2];
+
+    Trie trie;
+    if (strcmp(source, "fruits") == 0) {
+        for (const char* word : WordsFruits())
+            trie.insert(word);
+    } else if (strcmp(source, "words10000") == 0) {
+        for (const char* word : Words10000())
+            trie.insert(word);
+    } else if (!readWords(source, trie)) {
+        fprintf(stderr, "can't read %s\n", source);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[3], "wb");
+    if (!out) {
+        fprintf(stderr, "can't write %s\n", argv[3]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by TrieCodegen from %s, do not edit.\n\n", source);
+    fprintf(out, "int %s(const char* text)\n{\n", functionName);
+    if (trie.root.getSize() == 0) {
+        fprintf(out, "    (void)text;\n    return 0;\n}\n");
+    } else {
+        fprintf(out, "    int lenEnd = 0;\n");
+        emitNode(out, trie.root, 0, 1);
+        fprintf(out, "    return lenEnd;\n}\n");
+    }
+
+    return fclose(out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+#ifndef DATASETS_H
+#define DATASETS_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reproducible synthetic key sets and query streams for scaling tests, from 10K to 100M keys.
+// The same (kind, numKeys, seed) always yields the same keys with a given standard library.
+
+enum class DatasetKind {
+    NaturalWords, // english-like letter and length distribution
+    UrlPaths, // /api/v2/users/8812/orders, deep shared prefixes
+    BinaryKeys, // arbitrary bytes except NUL and missChar
+    Ipv4Prefixes, // routing table prefixes as strings of '0' and '1'
+    Ipv6Prefixes,
+    Identifiers, // long-tail qualified names
+};
+
+inline const char* datasetName(DatasetKind kind)
+{
+    switch (kind) {
+    case DatasetKind::NaturalWords: return "natural";
+    case DatasetKind::UrlPaths: return "urls";
+    case DatasetKind::BinaryKeys: return "binary";
+    case DatasetKind::Ipv4Prefixes: return "ipv4";
+    case DatasetKind::Ipv6Prefixes: return "ipv6";
+    case DatasetKind::Identifiers: return "idents";
+    }
+    return "unknown";
+}
+
+// no generator emits this char, replacing any char of a key with it gives a guaranteed non-key
+constexpr char missChar = '\x7f';
+
+// NUL-terminated strings in one buffer, 100M keys don't need 100M allocations
+class KeySet {
+    std::vector<char> m_chars;
+    std::vector<size_t> m_offsets;
+
+public:
+    void add(std::string_view key)
+    {
+        m_offsets.push_back(m_chars.size());
+        m_chars.insert(m_chars.end(), key.begin(), key.end());
+        m_chars.push_back('\0');
+    }
+
+    size_t size() const { return m_offsets.size(); }
+    const char* operator[](size_t index) const { return m_chars.data() + m_offsets[index]; }
+    size_t keyBytes() const { return m_chars.size() - m_offsets.size(); }
+
+    void reserve(size_t numKeys, size_t numChars)
+    {
+        m_offsets.reserve(numKeys);
+        m_chars.reserve(numChars);
+    }
+
+    // drops duplicates and shuffles, keys are inserted in random order
+    void dedupe(uint64_t seed)
+    {
+        std::vector<std::string_view> keys;
+        keys.reserve(size());
+        for (size_t i = 0; i < size(); ++i)
+            keys.push_back((*this)[i]);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+
+        KeySet unique;
+        unique.reserve(keys.size(), m_chars.size());
+        for (auto key : keys)
+            unique.add(key);
+        *this = std::move(unique);
+    }
+};
+
+// Ranks in [0, n) with P(rank) ~ 1 / (rank + 1)^s, by inverting the continuous approximation
+// of the distribution so no table of n probabilities is needed
+class ZipfDistribution {
+    size_t m_n;
+    double m_s;
+
+public:
+    ZipfDistribution(size_t n, double s)
+        : m_n(n)
+        , m_s(s)
+    {
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng& rng) const
+    {
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        const double n = (double)m_n;
+        double x; // in [1, n + 1)
+        if (std::abs(m_s - 1.0) < 1e-9)
+            x = std::exp(u * std::log(n + 1.0));
+        else
+            x = std::pow(u * (std::pow(n + 1.0, 1.0 - m_s) - 1.0) + 1.0, 1.0 / (1.0 - m_s));
+        return std::min((size_t)x - 1, m_n - 1);
+    }
+};
+
+namespace datasets_detail {
+
+inline char englishLetter(std::mt19937_64& rng)
+{
+    // letter frequencies of english text, per mille
+    static const int weights[26] = { 82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24, 67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1 };
+    static std::discrete_distribution<int> letters(std::begin(weights), std::end(weights));
+    return char('a' + letters(rng));
+}
+
+inline std::string naturalWord(std::mt19937_64& rng)
+{
+    // lengths peak around 7 with a tail up to 20
+    const int len = std::clamp((int)std::lround(std::lognormal_distribution<double>(1.9, 0.35)(rng)), 1, 20);
+    std::string word;
+    for (int i = 0; i < len; ++i)
+        word += englishLetter(rng);
+    return word;
+}
+
+inline std::string urlPath(std::mt19937_64& rng)
+{
+    static const char* segments[] = { "api", "v1", "v2", "v3", "users", "orders", "items", "search", "static", "img", "css", "js",
+        "admin", "settings", "profile", "cart", "checkout", "products", "categories", "reviews", "docs", "blog", "posts", "tags" };
+    std::string path;
+    const int depth = 2 + rng() % 5;
+    for (int i = 0; i < depth; ++i) {
+        path += '/';
+        if (i > 0 && rng() % 3 == 0)
+            path += std::to_string(rng() % 100000);
+        else
+            path += segments[ZipfDistribution(std::size(segments), 1.1)(rng)];
+    }
+    return path;
+}
+
+inline std::string binaryKey(std::mt19937_64& rng)
+{
+    std::string key(4 + rng() % 29, ' ');
+    for (auto& c : key) {
+        do
+            c = char(rng());
+        while (c == '\0' || c == missChar);
+    }
+    return key;
+}
+
+inline std::string bits(uint64_t value, int numBits)
+{
+    std::string result;
+    for (int i = numBits - 1; i >= 0; --i)
+        result += ((value >> i) & 1) ? '1' : '0';
+    return result;
+}
+
+inline std::string ipv4Prefix(std::mt19937_64& rng)
+{
+    // prefix lengths of a global routing table: mostly /24, some /16../23
+    static const int lengths[] = { 8, 12, 16, 19, 20, 21, 22, 23, 24 };
+    static const int weights[] = { 1, 2, 20, 20, 30, 40, 80, 60, 550 };
+    static std::discrete_distribution<int> lengthDistribution(std::begin(weights), std::end(weights));
+    return bits(rng(), lengths[lengthDistribution(rng)]);
+}
+
+inline std::string ipv6Prefix(std::mt19937_64& rng)
+{
+    static const int lengths[] = { 29, 32, 36, 40, 44, 48, 56, 64 };
+    static const int weights[] = { 5, 40, 10, 15, 20, 250, 20, 10 };
+    static std::discrete_distribution<int> lengthDistribution(std::begin(weights), std::end(weights));
+    // global unicast 2000::/3
+    return "001" + bits(rng(), lengths[lengthDistribution(rng)] - 3);
+}
+
+inline std::string identifier(std::mt19937_64& rng)
+{
+    static const char* parts[] = { "com", "org", "net", "example", "internal", "service", "core", "util", "data", "model",
+        "Handler", "Factory", "Manager", "Provider", "Request", "Response", "Config", "Builder", "Impl", "Abstract" };
+    // pareto number of segments gives a long tail of very long names
+    const double pareto = 1.0 / std::pow(1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(rng), 1.0 / 1.5);
+    const int numParts = 2 + (int)std::min(pareto, 38.0);
+    std::string name;
+    for (int i = 0; i < numParts; ++i) {
+        if (i)
+            name += '_';
+        name += parts[ZipfDistribution(std::size(parts), 0.8)(rng)];
+    }
+    return name + std::to_string(rng() % 1000);
+}
+
+} // namespace datasets_detail
+
+// numKeys distinct keys, fewer only if the generator can't produce that many
+inline KeySet generateDataset(DatasetKind kind, size_t numKeys, uint64_t seed)
+{
+    using namespace datasets_detail;
+    std::mt19937_64 rng(seed);
+    KeySet keys;
+
+    for (int attempt = 0; attempt < 4 && keys.size() < numKeys; ++attempt) {
+        keys.reserve(numKeys + numKeys / 8, numKeys * 16);
+        for (size_t i = keys.size(); i < numKeys + numKeys / 8; ++i) {
+            switch (kind) {
+            case DatasetKind::NaturalWords: keys.add(naturalWord(rng)); break;
+            case DatasetKind::UrlPaths: keys.add(urlPath(rng)); break;
+            case DatasetKind::BinaryKeys: keys.add(binaryKey(rng)); break;
+            case DatasetKind::Ipv4Prefixes: keys.add(ipv4Prefix(rng)); break;
+            case DatasetKind::Ipv6Prefixes: keys.add(ipv6Prefix(rng)); break;
+            case DatasetKind::Identifiers: keys.add(identifier(rng)); break;
+            }
+        }
+        keys.dedupe(seed);
+    }
+
+    KeySet result;
+    result.reserve(std::min(numKeys, keys.size()), keys.keyBytes() + keys.size());
+    for (size_t i = 0; i < keys.size() && i < numKeys; ++i)
+        result.add(keys[i]);
+    return result;
+}
+
+// A fraction hitRatio of the queries are keys picked with popularity ~ Zipf(zipfS),
+// the rest are keys with one char replaced by missChar, so misses still share a prefix.
+inline KeySet generateQueries(const KeySet& keys, size_t numQueries, double hitRatio, double zipfS, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution isHit(hitRatio);
+    ZipfDistribution popularity(keys.size(), zipfS);
+    KeySet queries;
+    if (keys.size() == 0)
+        return queries;
+    queries.reserve(numQueries, numQueries * (keys.keyBytes() / keys.size() + 1));
+
+    for (size_t i = 0; i < numQueries; ++i) {
+        // keys are stored shuffled, so rank order is unrelated to key order
+        std::string query = keys[popularity(rng)];
+        if (!isHit(rng))
+            query[rng() % query.size()] = missChar;
+        queries.add(query);
+    }
+    return queries;
+}
+
+#endif // DATASETS_H
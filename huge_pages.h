@@ -0,0 +1,96 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <new> // std::bad_alloc
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#if defined(__linux__)
+#include <sys/mman.h>
+#define TRIE_HAS_HUGE_PAGES 1
+#else
+#define TRIE_HAS_HUGE_PAGES 0
+#endif
+
+constexpr size_t hugePageSize = size_t(2) << 20;
+
+// Allocator of packed images. A random lookup touches a few nodes anywhere in the image, so
+// with 4K pages a multi-GB image misses the dTLB on nearly every node; one 2 MiB page covers
+// 512 times more of it. With hugePages a block of at least one huge page gets a mapping of its
+// own, 2 MiB aligned, backed by explicit huge pages (MAP_HUGETLB) if the system reserved them,
+// else by transparent ones (MADV_HUGEPAGE), else by the normal pages of that mapping. Smaller
+// blocks, systems without mmap and the default go through operator new.
+template <typename T>
+class ImageAllocator {
+    bool m_hugePages = false;
+
+public:
+    using value_type = T;
+    // the mode travels with the block, so containers take the allocator along
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    ImageAllocator() = default;
+    explicit ImageAllocator(bool hugePages)
+        : m_hugePages(hugePages)
+    {
+    }
+    template <typename U>
+    ImageAllocator(const ImageAllocator<U>& other)
+        : m_hugePages(other.hugePages())
+    {
+    }
+
+    bool hugePages() const { return m_hugePages; }
+
+    // a block of n elements gets its own mapping
+    bool maps(size_t n) const { return TRIE_HAS_HUGE_PAGES && m_hugePages && n * sizeof(T) >= hugePageSize; }
+
+    static size_t mappedBytes(size_t n) { return (n * sizeof(T) + hugePageSize - 1) & ~(hugePageSize - 1); }
+
+    T* allocate(size_t n)
+    {
+        if (!maps(n))
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+#if TRIE_HAS_HUGE_PAGES
+        const size_t bytes = mappedBytes(n);
+#ifdef MAP_HUGETLB
+        void* block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (block != MAP_FAILED)
+            return static_cast<T*>(block);
+#endif
+        // one huge page more, to cut an aligned range out of it
+        void* mapping = mmap(nullptr, bytes + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::bad_alloc();
+        uint8_t* const start = (uint8_t*)mapping;
+        uint8_t* const aligned = (uint8_t*)(((uintptr_t)start + hugePageSize - 1) & ~(uintptr_t)(hugePageSize - 1));
+        if (aligned != start)
+            munmap(start, aligned - start);
+        munmap(aligned + bytes, start + hugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, bytes, MADV_HUGEPAGE); // a hint, without THP the pages stay 4K
+#endif
+        return (T*)aligned;
+#else
+        throw std::bad_alloc();
+#endif
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (!maps(n)) {
+            ::operator delete(p);
+            return;
+        }
+#if TRIE_HAS_HUGE_PAGES
+        munmap(p, mappedBytes(n));
+#endif
+    }
+
+    friend bool operator==(const ImageAllocator& a, const ImageAllocator& b) { return a.m_hugePages == b.m_hugePages; }
+};
+
+#endif // HUGE_PAGES_H
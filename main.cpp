@@ -1,267 +1,92 @@
-#include <algorithm> // std::lower_bound
-#include <cassert>
-#include <cctype>
-#include <cstring> // memmove
-#include <stdint.h>
-#include <stdio.h>
-#include <utility> // std::pair
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 
+#include "multi_trie.h"
+#include "persistent_trie.h"
+#include "static_trie.h"
+#include "trie.h"
 #include "words.h"
 
-template <typename T>
-inline constexpr size_t align(size_t unaligned)
-{
-    constexpr size_t alignMask = (alignof(T) - 1);
-    static_assert((alignMask & alignof(T)) == 0); // is pow of 2
-    return (((size_t)unaligned + alignMask) & ~alignMask);
-}
-#define ARR_SIZE(x) sizeof(x) / sizeof(*x)
-
-template <typename Key, typename Val>
-class BinarySearchMap {
-public:
-    std::vector<Key> keys;
-    std::vector<Val> vals;
-
-public:
-    struct SoAIterator {
-        const Key* p1;
-        const Val* p2;
-
-        std::pair<const Key&, const Val&> operator*() const { return { *p1, *p2 }; }
-        bool operator!=(const SoAIterator& other) const { return p1 != other.p1; }
-
-        SoAIterator& operator++()
-        {
-            ++p1, ++p2;
-            return *this;
-        }
-    };
-
-    auto begin() const { return SoAIterator { keys.data(), vals.data() }; }
-    auto end() const { return SoAIterator { keys.data() + keys.size(), vals.data() + vals.size() }; }
-
-    Val& insert(const Key& key)
-    {
-        auto keyIt = std::lower_bound(keys.begin(), keys.end(), key);
-        int newKeyPos = std::distance(keys.begin(), keyIt);
-        auto valueIt = vals.begin() + newKeyPos;
-        if (keyIt == keys.end() || *keyIt != key) {
-            keys.insert(keyIt, key);
-            valueIt = vals.emplace(valueIt, Val {});
-        }
-        return *valueIt;
-    }
-
-    const Val* find(const Key& key) const
-    {
-        auto it = std::lower_bound(keys.begin(), keys.end(), key);
-        if (it != keys.end() && *it == key)
-            return &*(vals.begin() + std::distance(keys.begin(), it));
-        return nullptr;
-    }
-};
-
-struct TrieNode {
-    // Op op = opUnknown;
-    bool bStop = false;
-    BinarySearchMap<char, TrieNode*> children;
-
-    const auto& getKey(size_t index) const { return children.keys.at(index); }
-    const auto& getNode(size_t index) const { return children.vals.at(index); }
-    size_t getSize() const
-    {
-        assert(children.keys.size() == children.vals.size());
-        return children.keys.size();
-    }
-
-    void print(int offset) const
-    {
-        putchar('\n');
-        offset++;
-        for (const auto& [c, node] : children) {
-            for (int i = 0; i < offset; i++)
-                putchar(' ');
-            printf("%c", c);
-
-            node->print(offset);
-        }
-    }
-};
-
-class Trie {
-public:
-    TrieNode root;
-
-public:
-    void clear(TrieNode& n)
-    {
-        for (const auto& [k, v] : n.children) {
-            clear(*v);
-            delete v;
-        }
-    }
-
-    ~Trie() { clear(root); };
-
-    void insert(const char* word)
-    {
+static constexpr const char* keywords[] = { "if", "else", "for", "while", "return" };
+using Keywords = StaticTrie<keywords>;
+static_assert(Keywords::match("else if") == 4);
 
-        TrieNode* node = &root;
-        while (char c = *word) {
-            auto& foundNode = node->children.insert(c);
-            if (!foundNode)
-                foundNode = new TrieNode {};
-
-            node = foundNode;
-
-            word++;
-        }
-        // node->op = op;
-        node->bStop = true;
-    }
-
-    void print() { root.print(0); }
-
-    int match(const char* text) const
-    {
-        const TrieNode* node = &root;
-        int len = 0;
-
-        while (*text) {
-            TrieNode* const* foundValue = node->children.find(*text);
-            if (!foundValue)
-                break;
-
-            node = *foundValue;
-            ++len;
-
-            if (node->bStop == true) {
-                // op = node->op;
-                return len;
-            }
-
-            text++;
-        }
-
-        return 0;
-    }
-};
-
-// for (const auto& [k, v] : node.children)
-using IndexType = uint32_t;
-using NumType = uint8_t;
-using KeyType = char;
-
-class DenseTrie {
-public:
-    std::vector<uint8_t> m_data;
-
-public:
-    DenseTrie()
-    {
-        m_data.reserve(50);
-        assert(((size_t)m_data.data()) % 8 == 0);
-    }
-
-    static bool isIdent(char c) { return isalnum(c) || c == '_'; }
-
-    int match(const char* text) const
-    {
-        if (m_data.empty())
-            return 0;
-
-        size_t currentNode = 0;
-        int len = 0, lenEnd = 0;
-
-        while (const char& c = *text) {
-            // retrieve child odes
-            ++len;
-            const size_t numStart = currentNode;
-            const NumType num = *(NumType*)(&m_data.at(numStart));
-            const size_t keyOffsetStart = numStart + sizeof(NumType);
-            const KeyType* keys = (const KeyType*)(&m_data.at(keyOffsetStart));
-            const size_t childNodeOffsetStart = align<IndexType>(keyOffsetStart + num * sizeof(KeyType));
-            const IndexType* nodes = (const IndexType*)(&m_data.at(childNodeOffsetStart));
-
-            auto keysEnd = keys + num;
-            auto keyIt = std::lower_bound(keys, keysEnd, c);
-            if (keyIt == keysEnd || *keyIt != c) {
-                break; // not found
-            }
+int matchFruits(const char* text); // generated by TrieCodegen
 
-            currentNode = *(nodes + size_t(keyIt - keys));
-
-            if (currentNode == 0) {
-                lenEnd = len;
-            }
+// keys in order with their ids, then the best scored ones: what two equal images agree on
+static std::string describe(const DenseTrie& dtrie)
+{
+    std::string out;
+    for (const std::string& key : dtrie)
+        out += key + ' ' + std::to_string(dtrie.idOf(key.c_str())) + '\n';
+    char buffer[256];
+    dtrie.topK("", buffer, sizeof(buffer), 20, [&](const char* key, size_t len, ScoreType score) {
+        out.append(key, len) += ' ' + std::to_string(score) + '\n';
+    });
+    return out;
+}
 
-            auto nextKeyIt = keyIt + 1;
-            if (nextKeyIt != keysEnd && *keyIt == *nextKeyIt) {
-                lenEnd = len;
-            }
+static DenseTrie packed(const std::set<std::string>& keys, uint8_t flags = 0)
+{
+    Trie trie;
+    for (const std::string& key : keys)
+        trie.insert(key.c_str(), ScoreType(key.size() * 31 + (unsigned char)key[0]));
+    DenseTrie dtrie;
+    dtrie.pack(trie.root, flags);
+    return dtrie;
+}
 
-            ++text;
+// Levenshtein distance, what fuzzy() reports
+static int editDistance(const std::string& a, const std::string& b)
+{
+    std::vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j)
+        row[j] = int(j);
+    for (size_t i = 1; i <= a.size(); ++i) {
+        int diagonal = row[0];
+        row[0] = int(i);
+        for (size_t j = 1; j <= b.size(); ++j) {
+            const int above = row[j];
+            row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1]) });
+            diagonal = above;
         }
-
-        return lenEnd;
     }
+    return row[b.size()];
+}
 
-    void pack(const TrieNode& node)
-    {
-        // make additional shift for duplicates
-        int duplicateShift = 0;
-        for (int i = 0; i < node.getSize(); ++i) {
-            const TrieNode* childNode = node.getNode(i);
-            if (childNode->getSize() != 0 && childNode->bStop)
-                duplicateShift++;
-        }
-
-        const size_t nodeSize = node.getSize();
-        const size_t layoutSize = nodeSize + duplicateShift;
-
-        const size_t numStart = m_data.size();
-        const size_t keyStart = numStart + sizeof(NumType);
-        const size_t childNodeStart = align<IndexType>(keyStart + layoutSize * sizeof(KeyType));
-
-        m_data.resize(childNodeStart + layoutSize * sizeof(IndexType));
-        assert((size_t)m_data.data() % 8 == 0);
-
-        NumType* numPacked = (NumType*)&m_data.at(numStart);
-        KeyType* packedKeys = (KeyType*)&m_data.at(keyStart);
-        IndexType* packedNodes = (IndexType*)&m_data.at(childNodeStart);
-
-        *numPacked = nodeSize;
-
-        for (int I = 0, packedI = 0; I < nodeSize; ++I, ++packedI) {
-            const auto& childKey = node.getKey(I);
-            const auto& childNode = node.getNode(I);
-
-            packedKeys[packedI] = childKey;
-            packedNodes[packedI] = m_data.size();
-
-            if (childNode->getSize() != 0) {
-                packedNodes[packedI] = m_data.size();
-                pack(*childNode);
-
-                // as data can be reallocated we should update pointers
-                numPacked = (NumType*)&m_data.at(numStart);
-                packedKeys = (KeyType*)&m_data.at(keyStart);
-                packedNodes = (IndexType*)&m_data.at(childNodeStart);
-
-                if (childNode->bStop) {
-                    (*numPacked)++;
-                    packedKeys[++packedI] = childKey;
-                    packedNodes[packedI] = 0;
-                }
-
-            } else {
-                packedNodes[packedI] = 0;
+// glob match by backtracking, what wildcard() reports: ? * [a-c] [^a-c] [!a-c] and \ escapes
+static bool globMatch(const char* pattern, const char* key)
+{
+    if (*pattern == '\0')
+        return *key == '\0';
+    if (*pattern == '*')
+        return globMatch(pattern + 1, key) || (*key && globMatch(pattern, key + 1));
+    if (*key == '\0')
+        return false;
+    if (*pattern == '?')
+        return globMatch(pattern + 1, key + 1);
+    if (*pattern == '[') {
+        const char* p = pattern + 1;
+        const bool negate = *p == '^' || *p == '!';
+        p += negate;
+        bool in = false;
+        for (bool first = true; *p && (*p != ']' || first); ++p, first = false) {
+            unsigned char from = (unsigned char)*p, to = from;
+            if (p[1] == '-' && p[2] && p[2] != ']') {
+                to = (unsigned char)p[2];
+                p += 2;
             }
+            in = in || ((unsigned char)*key >= from && (unsigned char)*key <= to);
         }
+        return *p == ']' && in != negate && globMatch(p + 1, key + 1);
     }
-};
+    if (*pattern == '\\' && pattern[1])
+        ++pattern;
+    return *pattern == *key && globMatch(pattern + 1, key + 1);
+}
 
 #define WORDS 0
 int main()
@@ -303,9 +128,415 @@ int main()
 #endif
 
 #if 1
-    FILE* f = fopen("tree.bin", "wb");
-    fwrite(dtrie.m_data.data(), 1, dtrie.m_data.size(), f);
-    fclose(f);
+    Trie fruitTrie;
+    for (const char* f : WordsFruits())
+        fruitTrie.insert(f);
+
+    DenseTrie fruitDtrie;
+    fruitDtrie.pack(fruitTrie.root);
+    for (const char* f : WordsFruits()) {
+        std::string text = f;
+        for (const char* suffix : { "", "s", " fruit", "berry" })
+            if (matchFruits((text + suffix).c_str()) != fruitDtrie.match((text + suffix).c_str()))
+                printf("matchFruits differs from DenseTrie::match: %s%s\n", f, suffix);
+    }
+#endif
+
+#if 1
+    Trie keywordTrie;
+    for (const char* k : keywords)
+        keywordTrie.insert(k);
+
+    DenseTrie keywordDtrie;
+    keywordDtrie.pack(keywordTrie.root);
+    if (keywordDtrie.data().size() != Keywords::image.size()
+        || memcmp(keywordDtrie.data().data(), Keywords::image.data(), Keywords::image.size()) != 0)
+        printf("StaticTrie image differs from DenseTrie::pack\n");
+#endif
+
+#if 1
+    dtrie.save("tree.bin");
+
+    DenseTrie loaded;
+    if (!loaded.load("tree.bin"))
+        printf("tree.bin failed validation\n");
+
+    // root 'a' -> a node without entries, iterating it would read out of the node
+    const uint8_t emptyChild[] = { 1, 'a', 0, 0, 8, 0, 0, 0, 0, 0, 0, 0 };
+    if (FILE* f = fopen("corrupt.bin", "wb")) {
+        fwrite(emptyChild, 1, sizeof(emptyChild), f);
+        fclose(f);
+    }
+    if (loaded.load("corrupt.bin"))
+        printf("corrupt.bin with an empty child node passed validation\n");
+    remove("corrupt.bin");
+#endif
+
+    const std::vector<std::string> allWords(Words10000::begin(), Words10000::end());
+
+#if 1
+    // repack() after erase, update and insert against a fresh pack of the same keys; the fresh
+    // image packs a copy, packing edited itself would make the next repack() a full pack
+    Trie edited, copy;
+    for (Trie* trie : { &edited, &copy })
+        for (size_t i = 0; i < allWords.size(); ++i)
+            trie->insert(allWords[i].c_str(), ScoreType(i));
+    DenseTrie repacked;
+    repacked.pack(edited.root, PackScores);
+    for (size_t round = 0; round < 3; ++round) {
+        for (Trie* trie : { &edited, &copy }) {
+            for (size_t i = round; i < allWords.size(); i += 7)
+                trie->erase(allWords[i].c_str());
+            for (size_t i = round + 1; i < allWords.size(); i += 13)
+                trie->update(allWords[i].c_str(), ScoreType(allWords.size() + i));
+            for (size_t i = round; i < allWords.size(); i += 29)
+                trie->insert((allWords[i] + "zz").c_str(), ScoreType(2 * allWords.size() + i));
+        }
+        repacked.repack(edited.root, 1.0);
+        DenseTrie fresh;
+        fresh.pack(copy.root, PackScores);
+        if (describe(repacked) != describe(fresh))
+            printf("repack differs from pack after round %zu of edits\n", round);
+    }
+
+    // a WideDenseTrie packing the same trie in between takes the image id, repack() packs fully
+    WideDenseTrie wideCopy;
+    wideCopy.pack(edited.root, PackScores);
+    edited.insert("zzzzqq", 1);
+    copy.insert("zzzzqq", 1);
+    repacked.repack(edited.root);
+    DenseTrie fresh;
+    fresh.pack(copy.root, PackScores);
+    if (describe(repacked) != describe(fresh))
+        printf("repack after a WideDenseTrie pack differs from pack\n");
+#endif
+
+#if 1
+    // iteration both ways and lowerBound against a std::set, bytes >= 0x80 sort last
+    std::set<std::string> wordSet(allWords.begin(), allWords.end());
+    for (const char* key : { "\xC3\xA9t\xC3\xA9", "\xFF", "a\x80", "\x01" })
+        wordSet.insert(key);
+    Trie wordTrie;
+    for (const std::string& key : wordSet)
+        wordTrie.insert(key.c_str());
+    DenseTrie wordDtrie;
+    wordDtrie.pack(wordTrie.root);
+    const std::vector<std::string> sorted(wordSet.begin(), wordSet.end());
+    std::vector<std::string> forward;
+    for (const std::string& key : wordDtrie)
+        forward.push_back(key);
+    if (forward != sorted)
+        printf("forward iteration differs from the sorted keys\n");
+    std::vector<std::string> backward;
+    for (auto it = wordDtrie.end(); it != wordDtrie.begin();)
+        backward.push_back(*--it);
+    std::reverse(backward.begin(), backward.end());
+    if (backward != sorted)
+        printf("backward iteration differs from the sorted keys\n");
+    const std::string probes[] = { "", "a", "mid", "zzzz", "\xC3", sorted[100], sorted[100] + "a",
+        sorted[100].substr(0, 2) };
+    for (const std::string& probe : probes) {
+        const auto expected = std::lower_bound(sorted.begin(), sorted.end(), probe);
+        const auto found = wordDtrie.lowerBound(probe.c_str());
+        if (expected == sorted.end() ? found.valid() : !found.valid() || found.key() != *expected)
+            printf("lowerBound(%s) differs from the sorted keys\n", probe.c_str());
+    }
+#endif
+
+#if 1
+    // StreamScanner fed in chunks against scan()
+    Trie scanTrie;
+    for (size_t i = 0; i < allWords.size(); i += 3)
+        scanTrie.insert(allWords[i].c_str());
+    for (const char* key : { "ab", "new york", "york city", "\xD0\xB6" "ab", "\xC3\xA9" })
+        scanTrie.insert(key);
+    for (uint8_t flags : { uint8_t(0), uint8_t(PackUtf8) }) {
+        DenseTrie scanDtrie;
+        scanDtrie.pack(scanTrie.root, flags);
+        std::string text = "ab new york city, ab_ab xab ab1 \xC3\xA9" "ab \xD0\xB6" "ab \xC3\xA9 \xC3 ab\xA9 x\xC3\xA9 ";
+        for (size_t i = 0; i < 2000; i += 7)
+            text += allWords[i] + (i % 3 ? " " : "_");
+        std::vector<std::pair<size_t, int>> scanned, streamed;
+        scanDtrie.scan(text.c_str(), [&](size_t offset, int len) { scanned.push_back({ offset, len }); });
+        for (size_t chunk : { 1, 2, 3, 5, 64 }) {
+            streamed.clear();
+            auto onMatch = [&](size_t offset, int len) { streamed.push_back({ offset, len }); };
+            auto scanner = scanDtrie.streamScanner();
+            for (size_t at = 0; at < text.size(); at += chunk)
+                scanner.feed(text.data() + at, std::min(chunk, text.size() - at), onMatch);
+            scanner.finish(onMatch);
+            if (streamed != scanned)
+                printf("StreamScanner in chunks of %zu differs from scan(), flags %d\n", chunk, flags);
+        }
+    }
+#endif
+
+#if 1
+    // combine() against pack() of the set operation on the keys
+    std::set<std::string> evens, thirds;
+    for (size_t i = 0; i < allWords.size(); ++i) {
+        if (i % 2 == 0)
+            evens.insert(allWords[i]);
+        if (i % 3 == 0)
+            thirds.insert(allWords[i]);
+    }
+    const DenseTrie evenTrie = packed(evens, PackScores);
+    const DenseTrie thirdTrie = packed(thirds, PackScores);
+    std::set<std::string> expected[3];
+    std::set_union(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+        std::inserter(expected[0], expected[0].end()));
+    std::set_intersection(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+        std::inserter(expected[1], expected[1].end()));
+    std::set_difference(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+        std::inserter(expected[2], expected[2].end()));
+    const SetOperation ops[3] = { SetOperation::Union, SetOperation::Intersection, SetOperation::Difference };
+    for (int i = 0; i < 3; ++i) {
+        DenseTrie combined;
+        combined.combine(evenTrie, thirdTrie, ops[i], PackScores);
+        if (describe(combined) != describe(packed(expected[i], PackScores)))
+            printf("combine differs from pack of set operation %d\n", i);
+    }
+#endif
+
+#if 1
+    // MultiDenseTrie::match against a DenseTrie per dictionary
+    std::vector<Trie> dicts(3);
+    for (size_t i = 0; i < allWords.size(); ++i)
+        dicts[i % 3].insert(allWords[i].c_str());
+    dicts[2].insert("car");
+    for (bool shareSuffixes : { true, false }) {
+        MultiDenseTrie multi;
+        multi.pack({ &dicts[0].root, &dicts[1].root, &dicts[2].root }, 0, shareSuffixes);
+        for (size_t d = 0; d < dicts.size(); ++d) {
+            DenseTrie single;
+            single.pack(dicts[d].root);
+            for (size_t i = 0; i < allWords.size(); i += 5) {
+                const std::string text = allWords[i] + "s and more";
+                if (multi.match(d, text.c_str()) != single.match(text.c_str()))
+                    printf("MultiDenseTrie differs from DenseTrie in dictionary %zu: %s\n", d, text.c_str());
+            }
+        }
+    }
+#endif
+
+#if 1
+    // complete() against the sorted keys with the prefix, at most limit of them
+    const std::set<std::string> completeKeys(allWords.begin(), allWords.end());
+    const DenseTrie completeDtrie = packed(completeKeys);
+    for (const std::string prefix : { "", "a", "pro", "the", "zz", "xyzzy" }) {
+        for (size_t limit : { 5, 100000 }) {
+            std::vector<std::string> expected, found;
+            for (auto it = completeKeys.lower_bound(prefix); it != completeKeys.end() && expected.size() < limit
+                 && it->compare(0, prefix.size(), prefix) == 0;
+                 ++it)
+                expected.push_back(*it);
+            char buffer[256];
+            completeDtrie.complete(prefix.c_str(), buffer, sizeof(buffer), limit,
+                [&](const char* key, size_t len) { found.emplace_back(key, len); });
+            if (found != expected)
+                printf("complete(%s) of at most %zu keys differs from the sorted keys\n", prefix.c_str(), limit);
+        }
+    }
+#endif
+
+#if 1
+    // fuzzy() against the edit distance to every key
+    const std::set<std::string> fuzzyKeys(allWords.begin(), allWords.end());
+    const DenseTrie fuzzyDtrie = packed(fuzzyKeys);
+    for (const std::string query : { "", "a", "teh", "prgoram", "hosue", "qqqqq" }) {
+        for (int maxDistance : { 0, 1, 2 }) {
+            std::vector<std::pair<std::string, int>> expected, found;
+            for (const std::string& key : fuzzyKeys) {
+                const int distance = editDistance(key, query);
+                if (distance <= maxDistance)
+                    expected.push_back({ key, distance });
+            }
+            char buffer[256];
+            fuzzyDtrie.fuzzy(query.c_str(), maxDistance, buffer, sizeof(buffer),
+                [&](const char* key, size_t len, int distance) { found.push_back({ { key, len }, distance }); });
+            if (found != expected)
+                printf("fuzzy(%s, %d) differs from the edit distances\n", query.c_str(), maxDistance);
+        }
+    }
+#endif
+
+#if 1
+    // wildcard() against matching the pattern to every key
+    const std::set<std::string> wildcardKeys(allWords.begin(), allWords.end());
+    const DenseTrie wildcardDtrie = packed(wildcardKeys);
+    const char* patterns[] = { "*", "a*", "*ing", "?a?", "*e*e*", "[a-c]??", "[^a-y]*", "[!aeiou]*[0-9s]", "t\\he" };
+    for (const char* pattern : patterns) {
+        std::vector<std::string> expected, found;
+        for (const std::string& key : wildcardKeys)
+            if (globMatch(pattern, key.c_str()))
+                expected.push_back(key);
+        char buffer[256];
+        wildcardDtrie.wildcard(pattern, buffer, sizeof(buffer),
+            [&](const char* key, size_t len) { found.emplace_back(key, len); });
+        if (found != expected)
+            printf("wildcard(%s) differs from matching every key\n", pattern);
+    }
+#endif
+
+#if 1
+    // match() in both modes and matchAll() of Trie and DenseTrie against the keys prefixing the text
+    std::set<std::string> prefixKeys(allWords.begin(), allWords.begin() + allWords.size() / 2);
+    for (const char* key : { "a", "an", "and", "andes" })
+        prefixKeys.insert(key);
+    Trie prefixTrie;
+    for (const std::string& key : prefixKeys)
+        prefixTrie.insert(key.c_str());
+    const DenseTrie prefixDtrie = packed(prefixKeys);
+    for (size_t i = 0; i < allWords.size(); i += 3) {
+        const std::string text = i % 2 ? allWords[i] + "s" : "andes " + allWords[i];
+        std::vector<int> expected, trieLens, denseLens;
+        for (size_t len = 1; len <= text.size(); ++len)
+            if (prefixKeys.count(text.substr(0, len)))
+                expected.push_back(int(len));
+        const int shortest = expected.empty() ? 0 : expected.front();
+        const int longest = expected.empty() ? 0 : expected.back();
+        prefixTrie.matchAll(text.c_str(), [&](int len) { trieLens.push_back(len); });
+        prefixDtrie.matchAll(text.c_str(), [&](int len) { denseLens.push_back(len); });
+        if (trieLens != expected || denseLens != expected)
+            printf("matchAll(%s) differs from the keys prefixing it\n", text.c_str());
+        if (prefixTrie.match(text.c_str(), MatchMode::Shortest) != shortest
+            || prefixTrie.match(text.c_str(), MatchMode::Longest) != longest
+            || prefixDtrie.match(text.c_str(), MatchMode::Shortest) != shortest
+            || prefixDtrie.match(text.c_str(), MatchMode::Longest) != longest)
+            printf("match(%s) differs from the shortest or longest key prefixing it\n", text.c_str());
+    }
+#endif
+
+#if 1
+    // PackFoldCase and Trie(true) with mixed-case keys and queries against lowercased ones
+    std::set<std::string> lowerKeys;
+    Trie foldedTrie(true);
+    for (size_t i = 0; i < allWords.size(); i += 2) {
+        std::string key = allWords[i];
+        lowerKeys.insert(key);
+        for (size_t c = i % 3; c < key.size(); c += 2)
+            key[c] = (char)toupper((unsigned char)key[c]);
+        foldedTrie.insert(key.c_str());
+    }
+    DenseTrie foldedDtrie;
+    foldedDtrie.pack(foldedTrie.root, PackFoldCase);
+    const DenseTrie lowerDtrie = packed(lowerKeys);
+    auto keysOf = [](const DenseTrie& dtrie, const char* from, const char* to) {
+        std::vector<std::string> keys;
+        dtrie.range(from, to, [&](const std::string& key) { keys.push_back(key); });
+        if (dtrie.upperBound(from).valid())
+            keys.push_back("upper " + dtrie.upperBound(from).key());
+        char buffer[256];
+        auto onKey = [&](const char* key, size_t len, int = 0) { keys.emplace_back(key, len); };
+        dtrie.complete(from, buffer, sizeof(buffer), 20, onKey);
+        dtrie.fuzzy(from, 1, buffer, sizeof(buffer), onKey);
+        return keys;
+    };
+    for (size_t i = 0; i < allWords.size(); i += 7) {
+        std::string query = allWords[i] + (i % 2 ? "" : " Tail");
+        const std::string lower = foldCase(query);
+        for (size_t c = i % 2; c < query.size(); c += 2)
+            query[c] = (char)toupper((unsigned char)query[c]);
+        if (foldedDtrie.match(query.c_str()) != lowerDtrie.match(lower.c_str())
+            || foldedTrie.match(query.c_str(), MatchMode::Longest) != lowerDtrie.match(lower.c_str())
+            || foldedTrie.contains(query.c_str()) != (lowerKeys.count(lower) != 0))
+            printf("folded match of %s differs from the lowercased one\n", query.c_str());
+        const std::string to = query.substr(0, 1) + "Z";
+        const auto foldedKeys = keysOf(foldedDtrie, query.c_str(), to.c_str());
+        if (foldedKeys != keysOf(lowerDtrie, lower.c_str(), foldCase(to).c_str()))
+            printf("folded range, upperBound, complete or fuzzy of %s differ from the lowercased ones\n", query.c_str());
+    }
+#endif
+
+#if 1
+    // Trie erase, update and contains against a std::map of the same edits
+    std::map<std::string, ScoreType> model;
+    Trie editTrie;
+    for (size_t i = 0; i < allWords.size(); ++i) {
+        const std::string& word = allWords[(i * 7919) % allWords.size()];
+        // a word inserted earlier, or a prefix that may or may not be one
+        const std::string other = i % 8 < 4 ? allWords[(i * 31) % allWords.size()] : allWords[i].substr(0, 1 + i % 3);
+        switch (i % 4) {
+        case 0:
+        case 1:
+            editTrie.insert(word.c_str(), ScoreType(i));
+            model[word] = ScoreType(i);
+            break;
+        case 2:
+            if (editTrie.erase(other.c_str()) != (model.erase(other) != 0))
+                printf("erase(%s) result differs from the model\n", other.c_str());
+            break;
+        case 3:
+            if (editTrie.update(other.c_str(), ScoreType(i)) != (model.count(other) != 0))
+                printf("update(%s) result differs from the model\n", other.c_str());
+            if (model.count(other))
+                model[other] = ScoreType(i);
+            break;
+        }
+    }
+    for (size_t i = 0; i < allWords.size(); ++i) {
+        const std::string prefix = allWords[i].substr(0, 1 + i % 3);
+        if (editTrie.contains(allWords[i].c_str()) != (model.count(allWords[i]) != 0)
+            || editTrie.contains(prefix.c_str()) != (model.count(prefix) != 0))
+            printf("contains(%s) differs from the model\n", allWords[i].c_str());
+    }
+    DenseTrie editDtrie;
+    editDtrie.pack(editTrie.root, PackScores);
+    std::string editKeys, modelKeys;
+    for (const std::string& key : editDtrie)
+        editKeys += key + ' ';
+    char editBuffer[256];
+    editDtrie.topK("", editBuffer, sizeof(editBuffer), 20, [&](const char* key, size_t len, ScoreType score) {
+        editKeys.append(key, len) += ' ' + std::to_string(score);
+    });
+    std::vector<std::pair<ScoreType, std::string>> byScore;
+    for (const auto& [key, score] : model) {
+        modelKeys += key + ' ';
+        byScore.push_back({ score, key });
+    }
+    std::sort(byScore.rbegin(), byScore.rend());
+    for (size_t i = 0; i < byScore.size() && i < 20; ++i)
+        modelKeys += byScore[i].second + ' ' + std::to_string(byScore[i].first);
+    if (editKeys != modelKeys)
+        printf("keys and scores after erase and update differ from the model\n");
+#endif
+
+#if 1
+    // PersistentTrie versions against a std::set per version, rollback to an older one
+    PersistentTrie persistent;
+    std::vector<PersistentTrie::Snapshot> versions;
+    std::vector<std::set<std::string>> versionKeys;
+    std::set<std::string> currentKeys;
+    for (size_t batch = 0; batch < 8; ++batch) {
+        for (size_t i = batch; i < allWords.size(); i += 40) {
+            persistent.insert(allWords[i].c_str());
+            currentKeys.insert(allWords[i]);
+        }
+        for (size_t i = batch * 3; i < allWords.size(); i += 90)
+            if (persistent.erase(allWords[i].c_str()) != (currentKeys.erase(allWords[i]) != 0))
+                printf("PersistentTrie::erase(%s) result differs from the set\n", allWords[i].c_str());
+        versions.push_back(persistent.snapshot());
+        versionKeys.push_back(currentKeys);
+    }
+    persistent.rollback(versions[3]);
+    for (size_t v = 0; v < versions.size(); ++v) {
+        std::vector<std::string> keys;
+        versions[v].forEach([&](const std::string& key, ScoreType) { keys.push_back(key); });
+        if (keys != std::vector<std::string>(versionKeys[v].begin(), versionKeys[v].end()))
+            printf("PersistentTrie version %zu differs from its set\n", v);
+        for (size_t i = 0; i < allWords.size(); i += 11) {
+            const std::string text = allWords[i] + "s";
+            int longest = 0;
+            for (size_t len = 1; len <= text.size(); ++len)
+                if (versionKeys[v].count(text.substr(0, len)))
+                    longest = int(len);
+            if (versions[v].match(text.c_str(), MatchMode::Longest) != longest
+                || versions[v].contains(allWords[i].c_str()) != (versionKeys[v].count(allWords[i]) != 0))
+                printf("PersistentTrie version %zu differs from its set on %s\n", v, text.c_str());
+        }
+    }
+    if (!persistent.snapshot().sharesRootWith(versions[3]) || persistent.contains(allWords[7].c_str()))
+        printf("PersistentTrie::rollback didn't restore version 3\n");
 #endif
     return 0;
 }
@@ -0,0 +1,207 @@
+#ifndef MULTI_TRIE_H
+#define MULTI_TRIE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trie.h"
+
+// Several dictionaries in one packed image, e.g. a keyword set per tenant or per language:
+//     [IndexType numDicts][IndexType root of each dictionary][nodes]
+// Nodes are written children first and a node equal to one already written (same keys, same
+// children, same payload) is not written again, so the dictionaries share their common
+// subtrees, their own and each other's; the image is a DAG, which DenseTrie walks unchanged.
+// A dictionary is addressed by its position in pack(), naming them is up to the caller.
+//     MultiDenseTrie multi;
+//     multi.pack({ &cpp.root, &rust.root });
+//     multi.match(1, "fn main"); // 2
+class MultiDenseTrie {
+    DenseTrie m_image; // storage and node writer, its node 0 is the header here
+
+    static constexpr size_t headerBytes(size_t numDicts) { return (1 + numDicts) * sizeof(IndexType); }
+
+    const IndexType* header() const { return (const IndexType*)m_image.m_data.data(); }
+
+    // equal keys mean equal nodes: children are deduplicated before their parents
+    std::string nodeKey(const std::vector<DenseTrie::NodeEntry>& entries) const
+    {
+        std::string key;
+        key.reserve(entries.size() * sizeof(DenseTrie::NodeEntry));
+        for (const auto& entry : entries) {
+            key.append((const char*)&entry.key, sizeof(entry.key));
+            key.append((const char*)&entry.node, sizeof(entry.node));
+            if (m_image.m_flags & PackScores)
+                key.append((const char*)&entry.score, sizeof(entry.score));
+            if (m_image.m_flags & PackCounts)
+                key.append((const char*)&entry.count, sizeof(entry.count));
+        }
+        return key;
+    }
+
+    // offset of the node written for node, 0 if it can't be packed; same entries as DenseTrie::pack
+    IndexType packNode(const TrieNode& node, DenseTrie::PackedNode& packed,
+        std::unordered_map<std::string, IndexType>* written)
+    {
+        std::vector<DenseTrie::NodeEntry> entries;
+        entries.reserve(node.getSize() + 1);
+
+        for (size_t i = 0; i < node.getSize(); ++i) {
+            const TrieNode& child = *node.getNode(i);
+            const KeyType key = node.getKey(i);
+            if (child.getSize() == 0) {
+                entries.push_back({ key, 0, child.score, 1 });
+                packed.maxScore = std::max(packed.maxScore, child.score);
+                packed.numKeys++;
+                continue;
+            }
+
+            DenseTrie::PackedNode below;
+            const IndexType childOffset = packNode(child, below, written);
+            if (!childOffset)
+                return 0;
+            const ScoreType childMax = child.bStop ? std::max(below.maxScore, child.score) : below.maxScore;
+            entries.push_back({ key, childOffset, childMax, below.numKeys });
+            packed.maxScore = std::max(packed.maxScore, childMax);
+            packed.numKeys += below.numKeys;
+            if (child.bStop) {
+                entries.push_back({ key, 0, child.score, 1 });
+                packed.numKeys++;
+            }
+        }
+
+        std::string key;
+        if (written) {
+            key = nodeKey(entries);
+            auto it = written->find(key);
+            if (it != written->end())
+                return it->second;
+        }
+
+        const size_t numStart = m_image.m_data.size();
+        if (!m_image.fitsNode(numStart, entries.size(), std::numeric_limits<IndexType>::max()))
+            return 0;
+        m_image.writeNode(numStart, entries);
+        if (written)
+            written->emplace(std::move(key), IndexType(numStart));
+        return IndexType(numStart);
+    }
+
+    // header in range and every dictionary validates, a shared node is checked once
+    static bool validate(const uint8_t* data, size_t size, uint8_t flags)
+    {
+        if (size < headerBytes(0))
+            return false;
+        const IndexType* header = (const IndexType*)data;
+        const size_t numDicts = header[0];
+        if (numDicts > (size - headerBytes(0)) / sizeof(IndexType))
+            return false;
+
+        std::vector<size_t> roots(header + 1, header + 1 + numDicts);
+        for (size_t root : roots)
+            if (root < headerBytes(numDicts))
+                return false;
+        return DenseTrie::validateRoots(data, size, flags, roots.data(), roots.size());
+    }
+
+public:
+    // One dictionary per root, in this order. shareSuffixes writes every distinct subtree once;
+    // without it each dictionary is laid out as by DenseTrie::pack. false, leaving the image
+    // empty, if a node can't be packed or the image outgrows 32-bit offsets.
+    bool pack(const std::vector<const TrieNode*>& roots, uint8_t flags = 0, bool shareSuffixes = true)
+    {
+        ImageBuffer& data = m_image.m_data;
+        data.assign(headerBytes(roots.size()), 0);
+        m_image.m_flags = flags;
+        m_image.m_packedRoot = nullptr;
+
+        std::unordered_map<std::string, IndexType> written;
+        std::vector<IndexType> rootOffsets;
+        rootOffsets.reserve(roots.size());
+        bool ok = roots.size() <= std::numeric_limits<IndexType>::max();
+        for (size_t i = 0; i < roots.size() && ok; ++i) {
+            DenseTrie::PackedNode packed;
+            rootOffsets.push_back(packNode(*roots[i], packed, shareSuffixes ? &written : nullptr));
+            ok = rootOffsets.back() != 0;
+        }
+
+        if (ok) {
+            IndexType* header = (IndexType*)data.data();
+            header[0] = IndexType(roots.size());
+            std::copy(rootOffsets.begin(), rootOffsets.end(), header + 1);
+        }
+        if (!ok || !validate(data.data(), data.size(), flags)) {
+            data.clear();
+            return false;
+        }
+        m_image.resetNodeStats();
+        return true;
+    }
+
+    size_t numDicts() const { return m_image.m_data.empty() ? 0 : header()[0]; }
+    const ImageBuffer& data() const { return m_image.m_data; }
+    uint8_t flags() const { return m_image.m_flags; }
+
+    // see DenseTrie::useHugePages, one image for all tenants fills its huge pages best
+    void useHugePages(bool enable) { m_image.useHugePages(enable); }
+
+    // DenseTrie::match in dictionary dictId, which must be below numDicts()
+    int match(size_t dictId, const char* text, MatchMode mode = MatchMode::Longest) const
+    {
+        assert(dictId < numDicts());
+        int lenEnd = 0;
+        m_image.walk(text, [&](const char* end) {
+            lenEnd = int(end - text);
+            return mode != MatchMode::Shortest;
+        }, header()[1 + dictId]);
+        return lenEnd;
+    }
+
+    // onMatch(int len) for every stop of dictionary dictId on the path, shortest first
+    template <typename OnMatch>
+    int matchAll(size_t dictId, const char* text, OnMatch&& onMatch) const
+    {
+        assert(dictId < numDicts());
+        int count = 0;
+        m_image.walk(text, [&](const char* end) {
+            onMatch(int(end - text));
+            count++;
+            return true;
+        }, header()[1 + dictId]);
+        return count;
+    }
+
+    bool contains(size_t dictId, const char* key) const
+    {
+        bool found = false;
+        matchAll(dictId, key, [&](int len) { found = found || key[len] == '\0'; });
+        return found;
+    }
+
+    bool save(const char* path) const
+    {
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            return false;
+        const ImageBuffer& data = m_image.m_data;
+        bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+        return fclose(f) == 0 && ok;
+    }
+
+    // like DenseTrie::load, the header is checked too
+    bool load(const char* path, uint8_t flags = 0)
+    {
+        ImageBuffer& data = m_image.m_data;
+        data.clear();
+        m_image.m_flags = flags;
+        m_image.m_packedRoot = nullptr;
+        if (!DenseTrie::readFile(path, data) || !validate(data.data(), data.size(), flags)) {
+            data.clear();
+            return false;
+        }
+        m_image.resetNodeStats();
+        return true;
+    }
+};
+
+#endif // MULTI_TRIE_H
@@ -0,0 +1,148 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Hardware counters around a block of code via Linux perf_event_open. Each counter is opened
+// on its own, so one missing in a VM or container doesn't disable the others. With more
+// counters than the PMU has registers the kernel multiplexes them, each counting only part
+// of the time; values are scaled by the block's time enabled / time running to estimate it all.
+// Built only with TRIE_PERF_COUNTERS on Linux, otherwise every counter reads as unavailable.
+
+#if defined(TRIE_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define TRIE_HAS_PERF_COUNTERS 1
+#else
+#define TRIE_HAS_PERF_COUNTERS 0
+#endif
+
+class PerfCounters {
+public:
+    enum Counter { Cycles, Instructions, L1dMisses, LlcMisses, DtlbMisses, BranchMisses, NumCounters };
+
+    static const char* name(Counter counter)
+    {
+        static const char* names[NumCounters] = { "cycles", "instructions", "l1d-miss", "llc-miss", "dtlb-miss", "branch-miss" };
+        return names[counter];
+    }
+
+private:
+    int m_fds[NumCounters];
+    uint64_t m_values[NumCounters] = {};
+    // count, time enabled and time running at start(); the reset clears only the count
+    uint64_t m_startReads[NumCounters][3] = {};
+
+#if TRIE_HAS_PERF_COUNTERS
+    static int open(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr {};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    // count, time enabled, time running; false if the read failed
+    static bool readCounter(int fd, uint64_t (&values)[3])
+    {
+        return read(fd, values, sizeof(values)) == sizeof(values);
+    }
+
+    static uint64_t cacheMiss(uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+public:
+    PerfCounters()
+    {
+        for (int& fd : m_fds)
+            fd = -1;
+#if TRIE_HAS_PERF_COUNTERS
+        m_fds[Cycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        m_fds[Instructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        m_fds[L1dMisses] = open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D));
+        m_fds[LlcMisses] = open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL));
+        m_fds[DtlbMisses] = open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB));
+        m_fds[BranchMisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#if TRIE_HAS_PERF_COUNTERS
+        for (int fd : m_fds)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available(Counter counter) const { return m_fds[counter] >= 0; }
+
+    bool anyAvailable() const
+    {
+        for (int fd : m_fds)
+            if (fd >= 0)
+                return true;
+        return false;
+    }
+
+    void start()
+    {
+#if TRIE_HAS_PERF_COUNTERS
+        for (int i = 0; i < NumCounters; ++i) {
+            if (m_fds[i] >= 0) {
+                ioctl(m_fds[i], PERF_EVENT_IOC_RESET, 0);
+                if (!readCounter(m_fds[i], m_startReads[i]))
+                    m_startReads[i][0] = m_startReads[i][1] = m_startReads[i][2] = 0;
+                ioctl(m_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop()
+    {
+#if TRIE_HAS_PERF_COUNTERS
+        for (int i = 0; i < NumCounters; ++i) {
+            m_values[i] = 0;
+            if (m_fds[i] >= 0) {
+                ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                uint64_t end[3];
+                if (!readCounter(m_fds[i], end))
+                    continue;
+                const uint64_t* begin = m_startReads[i];
+                const uint64_t enabled = end[1] - begin[1];
+                const uint64_t running = end[2] - begin[2];
+                if (running != 0)
+                    m_values[i] = uint64_t((double)(end[0] - begin[0]) * enabled / running);
+            }
+        }
+#endif
+    }
+
+    // between the last start() and stop(), scaled when multiplexed; 0 if it never ran
+    uint64_t value(Counter counter) const { return m_values[counter]; }
+
+    // "cycles 812.3 instructions 1204.0 ..." divided by numOps, unavailable counters are skipped
+    void print(FILE* out, double numOps) const
+    {
+        for (int i = 0; i < NumCounters; ++i)
+            if (available(Counter(i)))
+                fprintf(out, " %s %.2f", name(Counter(i)), m_values[i] / numOps);
+    }
+};
+
+#endif // PERF_COUNTERS_H
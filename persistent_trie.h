@@ -0,0 +1,203 @@
+#ifndef PERSISTENT_TRIE_H
+#define PERSISTENT_TRIE_H
+
+#include <memory> // std::shared_ptr, std::atomic_load
+#include <string>
+
+#include "trie.h"
+
+// Trie with versions: insert and erase copy the nodes on the path of the word and share every
+// other node with the previous version, so a snapshot is one pointer and older versions stay
+// readable and restorable without cloning the structure. Nodes never change once published
+// and the current version is swapped atomically: while one thread at a time writes (insert,
+// erase, update, rollback), any thread may call snapshot(), match() and contains() on the
+// PersistentTrie and read its own Snapshot. A Snapshot object itself isn't shared between
+// threads without synchronization, copies of it are.
+//     PersistentTrie trie;
+//     trie.insert("if");
+//     PersistentTrie::Snapshot before = trie.snapshot();
+//     trie.insert("else");
+//     before.match("else"); // 0, trie.match("else") is 4
+//     trie.rollback(before);
+class PersistentTrie {
+public:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        bool bStop = false;
+        ScoreType score = 0;
+        BinarySearchMap<char, NodePtr, KeyLess> children;
+    };
+
+    class Snapshot {
+        NodePtr m_root; // null for no words
+
+        friend class PersistentTrie;
+
+        explicit Snapshot(NodePtr root)
+            : m_root(std::move(root))
+        {
+        }
+
+        // onStop(int len) for every stop on the path, shortest first, until it returns false
+        template <typename OnStop>
+        void walk(const char* text, OnStop&& onStop) const
+        {
+            const Node* node = m_root.get();
+            int len = 0;
+            while (node && *text) {
+                const NodePtr* child = node->children.find(*text);
+                if (!child)
+                    break;
+                node = child->get();
+                ++len;
+                if (node->bStop && !onStop(len))
+                    return;
+                text++;
+            }
+        }
+
+        template <typename Fn>
+        static void forEachFrom(const Node& node, std::string& key, Fn& fn)
+        {
+            if (node.bStop)
+                fn((const std::string&)key, node.score);
+            for (const auto& [c, child] : node.children) {
+                key.push_back(c);
+                forEachFrom(*child, key, fn);
+                key.pop_back();
+            }
+        }
+
+    public:
+        Snapshot() = default; // no words
+
+        // same results as Trie::match
+        int match(const char* text, MatchMode mode = MatchMode::Shortest) const
+        {
+            int lenEnd = 0;
+            walk(text, [&](int len) {
+                lenEnd = len;
+                return mode != MatchMode::Shortest;
+            });
+            return lenEnd;
+        }
+
+        bool contains(const char* word) const
+        {
+            const Node* node = m_root.get();
+            for (; node && *word; ++word) {
+                const NodePtr* child = node->children.find(*word);
+                node = child ? child->get() : nullptr;
+            }
+            return node && node->bStop;
+        }
+
+        // fn(const std::string& key, ScoreType score) in the order of the keys
+        template <typename Fn>
+        void forEach(Fn&& fn) const
+        {
+            std::string key;
+            if (m_root)
+                forEachFrom(*m_root, key, fn);
+        }
+
+        // inserts every word of this version, e.g. to DenseTrie::pack it
+        void insertInto(Trie& trie) const
+        {
+            forEach([&](const std::string& key, ScoreType score) { trie.insert(key.c_str(), score); });
+        }
+
+        // versions share a node as long as neither changed below it
+        bool sharesRootWith(const Snapshot& other) const { return m_root == other.m_root; }
+    };
+
+private:
+    NodePtr m_root; // the current version, null for no words; only std::atomic_load/store
+
+    NodePtr head() const { return std::atomic_load(&m_root); }
+    void setHead(NodePtr root) { std::atomic_store(&m_root, std::move(root)); }
+
+    // copy of node with word inserted, the children it doesn't touch are shared
+    static NodePtr insertFrom(const Node* node, const char* word, ScoreType score)
+    {
+        auto copy = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+        if (!*word) {
+            copy->bStop = true;
+            copy->score = score;
+        } else {
+            NodePtr& child = copy->children.insert(*word);
+            child = insertFrom(child.get(), word + 1, score);
+        }
+        return copy;
+    }
+
+    // copy of node without word, null once it leads to no word; node itself if word is missing
+    static NodePtr eraseFrom(const NodePtr& node, const char* word, bool& erased)
+    {
+        if (!node)
+            return node;
+        if (!*word) {
+            if (!node->bStop)
+                return node;
+            erased = true;
+            if (node->children.keys.empty())
+                return nullptr;
+            auto copy = std::make_shared<Node>(*node);
+            copy->bStop = false;
+            copy->score = 0;
+            return copy;
+        }
+
+        const NodePtr* child = node->children.find(*word);
+        if (!child)
+            return node;
+        NodePtr newChild = eraseFrom(*child, word + 1, erased);
+        if (!erased)
+            return node;
+
+        auto copy = std::make_shared<Node>(*node);
+        if (newChild)
+            *copy->children.find(*word) = std::move(newChild);
+        else
+            copy->children.erase(*word);
+        if (!copy->bStop && copy->children.keys.empty())
+            return nullptr;
+        return copy;
+    }
+
+public:
+    // O(key length) new nodes, the current version is unchanged for its snapshots
+    void insert(const char* word, ScoreType score = 0) { setHead(insertFrom(head().get(), word, score)); }
+
+    // false if word wasn't a word, nothing is copied then
+    bool erase(const char* word)
+    {
+        bool erased = false;
+        NodePtr root = eraseFrom(head(), word, erased);
+        if (erased)
+            setHead(std::move(root));
+        return erased;
+    }
+
+    // sets the score of an existing word, false if it isn't one
+    bool update(const char* word, ScoreType score)
+    {
+        if (!contains(word))
+            return false;
+        insert(word, score);
+        return true;
+    }
+
+    int match(const char* text, MatchMode mode = MatchMode::Shortest) const { return snapshot().match(text, mode); }
+    bool contains(const char* word) const { return snapshot().contains(word); }
+
+    // O(1), the version stays alive as long as the snapshot does
+    Snapshot snapshot() const { return Snapshot(head()); }
+
+    // makes a snapshot the current version again, e.g. to undo a failed batch
+    void rollback(const Snapshot& snapshot) { setHead(snapshot.m_root); }
+};
+
+#endif // PERSISTENT_TRIE_H
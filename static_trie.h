@@ -0,0 +1,165 @@
+#ifndef STATIC_TRIE_H
+#define STATIC_TRIE_H
+
+#include <array>
+#include <bit> // std::bit_cast
+#include <iterator> // std::size
+#include <string_view>
+#include <type_traits> // std::is_constant_evaluated
+
+#include "trie.h"
+
+// Packs a keyword list known at build time into the DenseTrie layout during compilation.
+// Words must have static storage duration:
+//     static constexpr const char* keywords[] = { "if", "else", "while" };
+//     static_assert(StaticTrie<keywords>::match("else if") == 4);
+template <const auto& Words>
+class StaticTrie {
+    static constexpr size_t wordCount = std::size(Words);
+
+    struct SortedWords {
+        std::array<std::string_view, wordCount> words {};
+        size_t count = 0;
+    };
+
+    // order of the packed keys (KeyLess), the order of string_view
+    static constexpr bool keyLess(std::string_view a, std::string_view b) { return a < b; }
+
+    static constexpr SortedWords sortWords()
+    {
+        SortedWords sorted;
+        for (const char* word : Words)
+            if (*word) // the root can't be a stop, DenseTrie drops it as well
+                sorted.words[sorted.count++] = word;
+
+        auto end = sorted.words.begin() + sorted.count;
+        std::sort(sorted.words.begin(), end, keyLess);
+        sorted.count = std::unique(sorted.words.begin(), end) - sorted.words.begin();
+        return sorted;
+    }
+
+    static constexpr SortedWords sorted = sortWords();
+
+    static constexpr size_t groupEnd(size_t lo, size_t hi, size_t depth)
+    {
+        const char c = sorted.words[lo][depth];
+        while (lo < hi && sorted.words[lo][depth] == c)
+            ++lo;
+        return lo;
+    }
+
+    // Same layout as DenseTrie::pack: words[lo, hi) share a prefix of length depth and are longer
+    // than it. With out == nullptr only the end offset is computed.
+    static constexpr size_t packNode(size_t lo, size_t hi, size_t depth, uint8_t* out, size_t numStart)
+    {
+        size_t layoutSize = 0;
+        for (size_t i = lo; i < hi;) {
+            const size_t end = groupEnd(i, hi, depth);
+            const bool stop = sorted.words[i].size() == depth + 1;
+            layoutSize += (stop && end - i > 1) ? 2 : 1; // duplicate for a stop with children
+            i = end;
+        }
+        // a throw fails constant evaluation, with or without NDEBUG
+        if (layoutSize > NumType(~0))
+            throw "StaticTrie: a node has more than 255 entries";
+
+        const size_t keyStart = numStart + sizeof(NumType);
+        const size_t childNodeStart = align<IndexType>(keyStart + layoutSize * sizeof(KeyType));
+        size_t nodeEnd = childNodeStart + layoutSize * sizeof(IndexType);
+
+        if (out)
+            out[numStart] = NumType(layoutSize);
+
+        auto writeEntry = [&](size_t packedI, char key, size_t child) {
+            if (child > IndexType(~0))
+                throw "StaticTrie: image outgrows 32-bit offsets";
+            if (!out)
+                return;
+            out[keyStart + packedI] = uint8_t(key);
+            const auto bytes = std::bit_cast<std::array<uint8_t, sizeof(IndexType)>>(IndexType(child));
+            for (size_t b = 0; b < bytes.size(); ++b)
+                out[childNodeStart + packedI * sizeof(IndexType) + b] = bytes[b];
+        };
+
+        size_t packedI = 0;
+        for (size_t i = lo; i < hi;) {
+            const size_t end = groupEnd(i, hi, depth);
+            const bool stop = sorted.words[i].size() == depth + 1;
+            const char key = sorted.words[i][depth];
+
+            if (end - i > (stop ? 1 : 0)) {
+                writeEntry(packedI++, key, nodeEnd);
+                nodeEnd = packNode(stop ? i + 1 : i, end, depth + 1, out, nodeEnd);
+                if (stop)
+                    writeEntry(packedI++, key, 0);
+            } else {
+                writeEntry(packedI++, key, 0);
+            }
+            i = end;
+        }
+        return nodeEnd;
+    }
+
+    static constexpr auto build()
+    {
+        std::array<uint8_t, packNode(0, sorted.count, 0, nullptr, 0)> bytes {};
+        packNode(0, sorted.count, 0, bytes.data(), 0);
+        return bytes;
+    }
+
+    static constexpr KeyType keyAt(size_t offset) { return KeyType(image[offset]); }
+
+    static constexpr size_t nodeAt(size_t offset)
+    {
+        if (std::is_constant_evaluated()) {
+            std::array<uint8_t, sizeof(IndexType)> bytes {};
+            for (size_t b = 0; b < bytes.size(); ++b)
+                bytes[b] = image[offset + b];
+            return std::bit_cast<IndexType>(bytes);
+        }
+        return *(const IndexType*)(image.data() + offset);
+    }
+
+public:
+    // byte-identical to DenseTrie::pack() of a Trie holding the same words
+    alignas(IndexType) static constexpr auto image = build();
+
+    // DenseTrie::match over the static image, usable in constant expressions
+    static constexpr int match(const char* text)
+    {
+        size_t currentNode = 0;
+        int len = 0, lenEnd = 0;
+
+        while (const char c = *text) {
+            ++len;
+            const size_t num = image[currentNode];
+            const size_t keyStart = currentNode + sizeof(NumType);
+            const size_t childNodeStart = align<IndexType>(keyStart + num * sizeof(KeyType));
+
+            size_t lo = 0, hi = num; // lower_bound
+            while (lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                if (KeyLess()(keyAt(keyStart + mid), c))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == num || keyAt(keyStart + lo) != c)
+                break; // not found
+
+            currentNode = nodeAt(childNodeStart + lo * sizeof(IndexType));
+            if (currentNode == 0) {
+                lenEnd = len; // leaf, nothing to follow
+                break;
+            }
+
+            if (lo + 1 != num && keyAt(keyStart + lo + 1) == c)
+                lenEnd = len;
+
+            ++text;
+        }
+        return lenEnd;
+    }
+};
+
+#endif // STATIC_TRIE_H
@@ -0,0 +1,2332 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+#include <algorithm> // std::lower_bound
+#include <array>
+#include <bit> // std::countr_zero
+#include <cassert>
+#include <cctype>
+#include <cstddef> // std::max_align_t
+#include <cstring> // memmove
+#include <functional> // std::less
+#include <limits>
+#ifdef __GLIBC__
+#include <malloc.h> // malloc_usable_size
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility> // std::pair
+#include <vector>
+
+#include "huge_pages.h"
+#include "utf8.h"
+
+template <typename T>
+inline constexpr size_t align(size_t unaligned)
+{
+    constexpr size_t alignMask = (alignof(T) - 1);
+    static_assert((alignMask & alignof(T)) == 0); // is pow of 2
+    return (((size_t)unaligned + alignMask) & ~alignMask);
+}
+#define ARR_SIZE(x) sizeof(x) / sizeof(*x)
+
+// ASCII lowercase, every other byte maps to itself
+inline constexpr std::array<char, 256> caseFoldTable = [] {
+    std::array<char, 256> table {};
+    for (int i = 0; i < 256; ++i)
+        table[i] = char(i >= 'A' && i <= 'Z' ? i - 'A' + 'a' : i);
+    return table;
+}();
+
+inline char foldCase(char c) { return caseFoldTable[(unsigned char)c]; }
+
+inline std::string foldCase(std::string_view text)
+{
+    std::string folded(text);
+    for (auto& c : folded)
+        c = foldCase(c);
+    return folded;
+}
+
+// Keys order as unsigned bytes, like std::string and memcmp, so UTF-8 and binary keys iterate
+// in the order of a std::set<std::string>. Every sorted key array, in a Trie or in a packed
+// image, is sorted by it.
+struct KeyLess {
+    constexpr bool operator()(char a, char b) const { return (unsigned char)a < (unsigned char)b; }
+};
+
+template <typename Key, typename Val, typename Less = std::less<Key>>
+class BinarySearchMap {
+public:
+    std::vector<Key> keys;
+    std::vector<Val> vals;
+
+public:
+    struct SoAIterator {
+        const Key* p1;
+        const Val* p2;
+
+        std::pair<const Key&, const Val&> operator*() const { return { *p1, *p2 }; }
+        bool operator!=(const SoAIterator& other) const { return p1 != other.p1; }
+
+        SoAIterator& operator++()
+        {
+            ++p1, ++p2;
+            return *this;
+        }
+    };
+
+    auto begin() const { return SoAIterator { keys.data(), vals.data() }; }
+    auto end() const { return SoAIterator { keys.data() + keys.size(), vals.data() + vals.size() }; }
+
+    Val& insert(const Key& key)
+    {
+        auto keyIt = std::lower_bound(keys.begin(), keys.end(), key, Less());
+        int newKeyPos = std::distance(keys.begin(), keyIt);
+        auto valueIt = vals.begin() + newKeyPos;
+        if (keyIt == keys.end() || *keyIt != key) {
+            keys.insert(keyIt, key);
+            valueIt = vals.emplace(valueIt, Val {});
+        }
+        return *valueIt;
+    }
+
+    const Val* find(const Key& key) const
+    {
+        auto it = std::lower_bound(keys.begin(), keys.end(), key, Less());
+        if (it != keys.end() && *it == key)
+            return &*(vals.begin() + std::distance(keys.begin(), it));
+        return nullptr;
+    }
+
+    Val* find(const Key& key) { return const_cast<Val*>(std::as_const(*this).find(key)); }
+
+    // false if there was no such key
+    bool erase(const Key& key)
+    {
+        auto keyIt = std::lower_bound(keys.begin(), keys.end(), key, Less());
+        if (keyIt == keys.end() || *keyIt != key)
+            return false;
+        vals.erase(vals.begin() + std::distance(keys.begin(), keyIt));
+        keys.erase(keyIt);
+        return true;
+    }
+};
+
+// Memory cost of a Trie or DenseTrie, see stats()
+struct TrieStats {
+    size_t nodes = 0; // including the root and leaves
+    size_t edges = 0;
+    size_t terminals = 0;
+    size_t maxDepth = 0;
+    double avgFanout = 0; // edges per inner node
+
+    size_t headerBytes = 0; // node bookkeeping: counts, vector headers, stop flags
+    size_t keyBytes = 0;
+    size_t offsetBytes = 0; // child pointers or packed offsets
+    size_t paddingBytes = 0; // alignment and unused vector capacity
+    size_t payloadBytes = 0;
+    size_t allocatorOverhead = 0; // malloc chunk headers and rounding
+
+    size_t totalBytes() const { return headerBytes + keyBytes + offsetBytes + paddingBytes + payloadBytes + allocatorOverhead; }
+
+    void print(FILE* out) const
+    {
+        fprintf(out, "nodes %zu edges %zu terminals %zu maxDepth %zu avgFanout %.2f ", nodes, edges, terminals, maxDepth, avgFanout);
+        fprintf(out, "bytes %zu: headers %zu keys %zu offsets %zu padding %zu payload %zu allocator %zu\n", totalBytes(),
+            headerBytes, keyBytes, offsetBytes, paddingBytes, payloadBytes, allocatorOverhead);
+    }
+};
+
+// bytes malloc spends on a block beyond the requested size
+inline size_t allocatorOverhead(const void* block, size_t requested)
+{
+    if (!block)
+        return 0;
+#ifdef __GLIBC__
+    return malloc_usable_size((void*)block) - requested + sizeof(size_t);
+#else
+    return align<std::max_align_t>(requested + sizeof(size_t)) - requested;
+#endif
+}
+
+using ScoreType = uint32_t;
+
+struct TrieNode {
+    // Op op = opUnknown;
+    bool bStop = false;
+    // changed since the last DenseTrie::pack or repack, and the offset it was packed at
+    // (0 for leaves), so repack() rewrites only the changed paths; the root is always at 0
+    // and keeps the id of the image instead
+    mutable bool dirty = true;
+    ScoreType score = 0; // popularity of the word ending here, for DenseTrie::topK
+    mutable size_t packedAt = 0;
+    BinarySearchMap<char, TrieNode*, KeyLess> children;
+
+    const auto& getKey(size_t index) const { return children.keys.at(index); }
+    const auto& getNode(size_t index) const { return children.vals.at(index); }
+    size_t getSize() const
+    {
+        assert(children.keys.size() == children.vals.size());
+        return children.keys.size();
+    }
+
+    void print(int offset) const
+    {
+        putchar('\n');
+        offset++;
+        for (const auto& [c, node] : children) {
+            for (int i = 0; i < offset; i++)
+                putchar(' ');
+            printf("%c", c);
+
+            node->print(offset);
+        }
+    }
+};
+
+// Which stop on the path of the text match() reports. Trie::match defaults to Shortest and
+// DenseTrie::match to Longest; every stop is what matchAll() of either reports.
+enum class MatchMode {
+    Shortest,
+    Longest,
+};
+
+class Trie {
+public:
+    TrieNode root;
+
+private:
+    bool m_foldCase = false;
+
+public:
+    Trie() = default;
+
+    // keys are stored in ASCII lowercase and matched regardless of case, pack with PackFoldCase
+    explicit Trie(bool foldCase)
+        : m_foldCase(foldCase)
+    {
+    }
+
+    bool foldsCase() const { return m_foldCase; }
+
+    void clear(TrieNode& n)
+    {
+        for (const auto& [k, v] : n.children) {
+            clear(*v);
+            delete v;
+        }
+    }
+
+    ~Trie() { clear(root); };
+
+    void insert(const char* word, ScoreType score = 0)
+    {
+
+        TrieNode* node = &root;
+        root.dirty = true;
+        while (char c = *word) {
+            auto& foundNode = node->children.insert(m_foldCase ? foldCase(c) : c);
+            if (!foundNode)
+                foundNode = new TrieNode {};
+
+            node = foundNode;
+            node->dirty = true;
+
+            word++;
+        }
+        // node->op = op;
+        node->bStop = true;
+        node->score = score;
+    }
+
+    // Removes word and frees the nodes no other word uses, false if it wasn't a word.
+    bool erase(const char* word) { return eraseFrom(root, word); }
+
+    // sets the score of an existing word, false if it isn't one
+    bool update(const char* word, ScoreType score)
+    {
+        TrieNode* node = find(word);
+        if (!node || !node->bStop)
+            return false;
+        node->score = score;
+        // the subtree maxima of PackScores change along the path
+        for (TrieNode* n = &root; n != node; n = *n->children.find(m_foldCase ? foldCase(*word) : *word), ++word)
+            n->dirty = true;
+        node->dirty = true;
+        return true;
+    }
+
+    bool contains(const char* word) const
+    {
+        const TrieNode* node = const_cast<Trie*>(this)->find(word);
+        return node && node->bStop;
+    }
+
+    void print() { root.print(0); }
+
+    TrieStats stats() const
+    {
+        TrieStats stats;
+        size_t innerNodes = 0;
+
+        auto visit = [&](auto& self, const TrieNode& node, size_t depth, bool onHeap) -> void {
+            const auto& keys = node.children.keys;
+            const auto& vals = node.children.vals;
+            stats.nodes++;
+            stats.edges += keys.size();
+            stats.terminals += node.bStop;
+            stats.maxDepth = std::max(stats.maxDepth, depth);
+            innerNodes += !keys.empty();
+
+            stats.headerBytes += sizeof(TrieNode) - sizeof(ScoreType);
+            stats.payloadBytes += sizeof(ScoreType);
+            stats.keyBytes += keys.size() * sizeof(char);
+            stats.offsetBytes += vals.size() * sizeof(TrieNode*);
+            stats.paddingBytes += (keys.capacity() - keys.size()) * sizeof(char) + (vals.capacity() - vals.size()) * sizeof(TrieNode*);
+            if (onHeap)
+                stats.allocatorOverhead += ::allocatorOverhead(&node, sizeof(TrieNode));
+            stats.allocatorOverhead += ::allocatorOverhead(keys.data(), keys.capacity() * sizeof(char));
+            stats.allocatorOverhead += ::allocatorOverhead(vals.data(), vals.capacity() * sizeof(TrieNode*));
+
+            for (const auto& [c, child] : node.children)
+                self(self, *child, depth + 1, true);
+        };
+        visit(visit, root, 0, false);
+
+        stats.avgFanout = innerNodes ? (double)stats.edges / innerNodes : 0;
+        return stats;
+    }
+
+    int match(const char* text, MatchMode mode = MatchMode::Shortest) const
+    {
+        int lenEnd = 0;
+        walk(text, [&](int len) {
+            lenEnd = len;
+            return mode != MatchMode::Shortest;
+        });
+        return lenEnd;
+    }
+
+    // onMatch(int len) for every stop on the path, shortest first; returns their number
+    template <typename OnMatch>
+    int matchAll(const char* text, OnMatch&& onMatch) const
+    {
+        int count = 0;
+        walk(text, [&](int len) {
+            onMatch(len);
+            count++;
+            return true;
+        });
+        return count;
+    }
+
+    // stores the first maxLens stop lengths, returns the number of all stops
+    int matchAll(const char* text, int* lens, int maxLens) const
+    {
+        return matchAll(text, [&, stored = 0](int len) mutable {
+            if (stored < maxLens)
+                lens[stored++] = len;
+        });
+    }
+
+private:
+    // node reached by the whole word, stop or not
+    TrieNode* find(const char* word)
+    {
+        TrieNode* node = &root;
+        for (; *word && node; ++word) {
+            TrieNode** child = node->children.find(m_foldCase ? foldCase(*word) : *word);
+            node = child ? *child : nullptr;
+        }
+        return node;
+    }
+
+    // recursion depth is the word length, like insert's path
+    bool eraseFrom(TrieNode& node, const char* word)
+    {
+        if (!*word) {
+            if (!node.bStop)
+                return false;
+            node.bStop = false;
+            node.dirty = true;
+            node.score = 0;
+            return true;
+        }
+
+        const char c = m_foldCase ? foldCase(*word) : *word;
+        TrieNode** child = node.children.find(c);
+        if (!child || !eraseFrom(**child, word + 1))
+            return false;
+        node.dirty = true;
+
+        // prune the branch once it leads to no word
+        if (!(*child)->bStop && (*child)->getSize() == 0) {
+            delete *child;
+            node.children.erase(c);
+        }
+        return true;
+    }
+
+    // onStop(int len) for every stop on the path, shortest first, until it returns false
+    template <typename OnStop>
+    void walk(const char* text, OnStop&& onStop) const
+    {
+        const TrieNode* node = &root;
+        int len = 0;
+
+        while (*text) {
+            TrieNode* const* foundValue = node->children.find(m_foldCase ? foldCase(*text) : *text);
+            if (!foundValue)
+                break;
+
+            node = *foundValue;
+            ++len;
+
+            if (node->bStop == true) {
+                // op = node->op;
+                if (!onStop(len))
+                    return;
+            }
+
+            text++;
+        }
+    }
+};
+
+// for (const auto& [k, v] : node.children)
+using IndexType = uint32_t; // DenseTrie, MultiDenseTrie and StaticTrie offsets; WideDenseTrie has 64-bit ones
+using NumType = uint8_t;
+using KeyType = char;
+using CountType = uint32_t;
+
+// Optional per-entry arrays stored after the child offsets of every node. The image has no
+// header, so the flags it was packed with must be passed again to load().
+enum PackFlags : uint8_t {
+    // ScoreType per entry: a leaf or stop entry holds its key's score, a subtree entry
+    // the max score of the keys below it
+    PackScores = 1 << 0,
+    // CountType per entry, after the scores: a leaf or stop entry counts 1, a subtree entry the
+    // keys below its child. Summing the counts along a path gives the rank of a key.
+    PackCounts = 1 << 1,
+    // keys are ASCII lowercase (a Trie built with foldCase) and queries are folded per byte
+    // while walking, so lookups ignore case without a lowered copy of the text
+    PackFoldCase = 1 << 2,
+    // keys and text are UTF-8: a match never ends inside a multibyte sequence and scan()
+    // checks identifier boundaries on codepoints; ASCII-only text takes the byte scan
+    PackUtf8 = 1 << 3,
+};
+
+// What DenseTrie::combine keeps of two key sets
+enum class SetOperation {
+    Union, // keys of either, the score of b for keys in both
+    Intersection, // keys of both, scores of a
+    Difference, // keys of a that b lacks
+};
+
+// storage of a packed image, on huge pages if DenseTrie::useHugePages() asked for them
+using ImageBuffer = std::vector<uint8_t, ImageAllocator<uint8_t>>;
+
+class MultiDenseTrie;
+
+// Id of a packed image, stored in TrieNode::packedAt of the root it was packed from. One
+// counter for every offset width, so a DenseTrie and a WideDenseTrie packing the same trie
+// never share an id. Not thread safe, like packing a shared trie.
+inline uint32_t nextImageId()
+{
+    static uint32_t lastImageId = 0;
+    return ++lastImageId;
+}
+
+template <typename OffsetType>
+class BasicDenseTrie {
+    // child offsets, and so the largest image; DenseTrie and WideDenseTrie below
+    using IndexType = OffsetType;
+
+    friend class MultiDenseTrie; // builds its image with the node writers below
+
+    // either empty or validated, match() walks it without range checks
+    ImageBuffer m_data;
+    uint8_t m_flags = 0;
+
+    // repack() state: the trie packed last, unreachable bytes, room for the root at offset 0
+    const TrieNode* m_packedRoot = nullptr;
+    uint32_t m_imageId = 0;
+    size_t m_garbage = 0;
+    size_t m_rootCapacity = 0;
+
+#ifdef TRIE_NODE_STATS
+    // match() visits per node offset and per depth, not thread safe. Keyed by node rather
+    // than indexed by image byte, so the counters grow with the nodes visited, not the image.
+    mutable std::unordered_map<size_t, uint64_t> m_nodeVisits;
+    mutable std::vector<uint64_t> m_depthVisits;
+#endif
+
+    struct NodeView {
+        NumType num;
+        const KeyType* keys;
+        const IndexType* nodes;
+        const ScoreType* scores; // null without PackScores
+        const CountType* counts; // null without PackCounts
+    };
+
+    static_assert(alignof(ScoreType) <= alignof(IndexType) && alignof(CountType) <= alignof(IndexType));
+
+    static size_t nodesStart(size_t keyStart, size_t num) { return align<IndexType>(keyStart + num * sizeof(KeyType)); }
+
+    static size_t nodeEnd(size_t numStart, size_t num, uint8_t flags)
+    {
+        const size_t entrySize = sizeof(IndexType) + ((flags & PackScores) ? sizeof(ScoreType) : 0)
+            + ((flags & PackCounts) ? sizeof(CountType) : 0);
+        return nodesStart(numStart + sizeof(NumType), num) + num * entrySize;
+    }
+
+    // unchecked, numStart must come from a validated image
+    NodeView nodeAt(size_t numStart) const
+    {
+        const uint8_t* data = m_data.data();
+        const NumType num = *(const NumType*)(data + numStart);
+        const size_t keyStart = numStart + sizeof(NumType);
+        const IndexType* nodes = (const IndexType*)(data + nodesStart(keyStart, num));
+        const ScoreType* scores = (m_flags & PackScores) ? (const ScoreType*)(nodes + num) : nullptr;
+        const uint8_t* countStart = scores ? (const uint8_t*)(scores + num) : (const uint8_t*)(nodes + num);
+        const CountType* counts = (m_flags & PackCounts) ? (const CountType*)countStart : nullptr;
+        return { num, (const KeyType*)(data + keyStart), nodes, scores, counts };
+    }
+
+    char queryChar(char c) const { return (m_flags & PackFoldCase) ? foldCase(c) : c; }
+
+    // <0, 0 or >0 as a packed key orders before, equal to or after query, which is folded char
+    // by char with PackFoldCase
+    int compareQuery(std::string_view key, const char* query) const
+    {
+        size_t i = 0;
+        for (; i < key.size() && query[i]; ++i) {
+            const char c = queryChar(query[i]);
+            if (key[i] != c)
+                return KeyLess()(key[i], c) ? -1 : 1;
+        }
+        return i < key.size() ? 1 : query[i] ? -1 : 0;
+    }
+
+    void countVisit(size_t numStart, size_t depth) const
+    {
+#ifdef TRIE_NODE_STATS
+        m_nodeVisits[numStart]++;
+        if (depth >= m_depthVisits.size())
+            m_depthVisits.resize(depth + 1);
+        m_depthVisits[depth]++;
+#else
+        (void)numStart, (void)depth;
+#endif
+    }
+
+    // fn(size_t numStart, const std::string& prefix) for every node below numStart, parents
+    // first; an explicit stack, since a loaded image may be as deep as it is long
+    template <typename Fn>
+    void forEachNode(size_t numStart, std::string& prefix, Fn&& fn) const
+    {
+        std::vector<std::pair<size_t, size_t>> stack; // node offset, next entry to visit
+        fn(numStart, (const std::string&)prefix);
+        stack.push_back({ numStart, 0 });
+        while (!stack.empty()) {
+            auto& [current, entry] = stack.back();
+            const NodeView node = nodeAt(current);
+            if (entry == node.num) {
+                stack.pop_back();
+                if (!stack.empty())
+                    prefix.pop_back();
+                continue;
+            }
+
+            const size_t child = node.nodes[entry++];
+            if (child == 0)
+                continue;
+            prefix.push_back(node.keys[entry - 1]);
+            fn(child, (const std::string&)prefix);
+            stack.push_back({ child, 0 });
+        }
+    }
+
+public:
+    BasicDenseTrie()
+    {
+        m_data.reserve(50);
+        assert(((size_t)m_data.data()) % 8 == 0);
+    }
+
+    const ImageBuffer& data() const { return m_data; }
+    uint8_t flags() const { return m_flags; }
+
+    // Moves the image, and every later pack() or load(), to 2 MiB pages once it spans one;
+    // falls back to normal pages where the system has none to give (see ImageAllocator).
+    void useHugePages(bool enable)
+    {
+        if (enable == usesHugePages())
+            return;
+        ImageBuffer data { ImageAllocator<uint8_t>(enable) };
+        data.reserve(m_data.capacity());
+        data.assign(m_data.begin(), m_data.end());
+        m_data.swap(data);
+        resetNodeStats();
+    }
+
+    bool usesHugePages() const { return m_data.get_allocator().hugePages(); }
+
+    // leaves aren't stored, they count as nodes of the logical trie; a duplicate entry is a stop, not an edge
+    TrieStats stats() const
+    {
+        TrieStats stats;
+        stats.paddingBytes = m_data.capacity() - m_data.size();
+        const ImageAllocator<uint8_t> allocator = m_data.get_allocator();
+        stats.allocatorOverhead = allocator.maps(m_data.capacity())
+            ? allocator.mappedBytes(m_data.capacity()) - m_data.capacity()
+            : ::allocatorOverhead(m_data.data(), m_data.capacity());
+        if (m_data.empty())
+            return stats;
+
+        size_t innerNodes = 0, reachableBytes = 0;
+        std::string prefix;
+        forEachNode(0, prefix, [&](size_t numStart, const std::string& nodePrefix) {
+            const NodeView node = nodeAt(numStart);
+            const size_t keyEnd = numStart + sizeof(NumType) + node.num * sizeof(KeyType);
+            const size_t end = nodeEnd(numStart, node.num, m_flags);
+            const size_t payload = (node.scores ? node.num * sizeof(ScoreType) : 0) + (node.counts ? node.num * sizeof(CountType) : 0);
+            reachableBytes += end - numStart;
+
+            stats.headerBytes += sizeof(NumType);
+            stats.keyBytes += node.num * sizeof(KeyType);
+            stats.offsetBytes += node.num * sizeof(IndexType);
+            stats.payloadBytes += payload;
+            stats.paddingBytes += end - keyEnd - node.num * sizeof(IndexType) - payload;
+
+            stats.nodes++;
+            innerNodes += node.num != 0;
+            stats.maxDepth = std::max(stats.maxDepth, nodePrefix.size());
+            for (size_t i = 0; i < node.num; ++i) {
+                const bool duplicate = i > 0 && node.keys[i - 1] == node.keys[i];
+                stats.edges += !duplicate;
+                stats.terminals += node.nodes[i] == 0;
+                if (node.nodes[i] == 0 && !duplicate) {
+                    stats.nodes++; // leaf
+                    stats.maxDepth = std::max(stats.maxDepth, nodePrefix.size() + 1);
+                }
+            }
+        });
+        stats.paddingBytes += m_data.size() - reachableBytes; // bytes no node uses
+
+        stats.avgFanout = innerNodes ? (double)stats.edges / innerNodes : 0;
+        return stats;
+    }
+
+    static bool isIdent(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+    // a keyword may start or end between a and b unless both are identifier chars
+    static bool isBoundary(char a, char b) { return !isIdent(a) || !isIdent(b); }
+
+    int match(const char* text, MatchMode mode = MatchMode::Longest) const
+    {
+        if (mode == MatchMode::Shortest) {
+            int lenEnd = 0;
+            walk(text, [&](const char* end) {
+                lenEnd = int(end - text);
+                return false;
+            });
+            return lenEnd;
+        }
+        return matchImpl(text, [](const char*) { return true; });
+    }
+
+    // onMatch(int len) for every stop on the path, shortest first, in one walk; returns their number
+    template <typename OnMatch>
+    int matchAll(const char* text, OnMatch&& onMatch) const
+    {
+        int count = 0;
+        walk(text, [&](const char* end) {
+            onMatch(int(end - text));
+            count++;
+            return true;
+        });
+        return count;
+    }
+
+    // stores the first maxLens stop lengths, returns the number of all stops
+    int matchAll(const char* text, int* lens, int maxLens) const
+    {
+        return matchAll(text, [&, stored = 0](int len) mutable {
+            if (stored < maxLens)
+                lens[stored++] = len;
+        });
+    }
+
+    static constexpr size_t noId = ~size_t(0);
+
+    // The rank of each key in the order of the packed keys is a dense id in [0, numKeys()), a
+    // minimal perfect hash of the key set. Needs an image packed with PackCounts.
+    size_t numKeys() const
+    {
+        if (!(m_flags & PackCounts) || m_data.empty())
+            return 0;
+        const NodeView root = nodeAt(0);
+        size_t count = 0;
+        for (size_t i = 0; i < root.num; ++i)
+            count += root.counts[i];
+        return count;
+    }
+
+    // id of the whole key, noId if it isn't a key or the image has no counts
+    size_t idOf(const char* key) const
+    {
+        size_t id = noId;
+        walkRanked(key, [&](const char* end, size_t rank) {
+            if (*end == '\0')
+                id = rank;
+            return true;
+        });
+        return id;
+    }
+
+    // match() that also sets id to the rank of the matched key, noId if nothing matched
+    int match(const char* text, size_t& id, MatchMode mode = MatchMode::Longest) const
+    {
+        int lenEnd = 0;
+        id = noId;
+        walkRanked(text, [&](const char* end, size_t rank) {
+            lenEnd = int(end - text);
+            id = rank;
+            return mode != MatchMode::Shortest;
+        });
+        return lenEnd;
+    }
+
+    // Writes the key with the given id into buffer, NUL-terminated, and returns its length;
+    // 0 if there is no such id or the key doesn't fit in bufferSize.
+    size_t keyOf(size_t id, char* buffer, size_t bufferSize) const
+    {
+        if (!(m_flags & PackCounts) || m_data.empty())
+            return 0;
+
+        size_t numStart = 0;
+        for (size_t depth = 0; depth + 1 < bufferSize; ++depth) {
+            const NodeView node = nodeAt(numStart);
+            size_t i = 0;
+            for (; i < node.num; ++i) {
+                const char key = node.keys[i];
+                if (i > 0 && node.keys[i - 1] == key)
+                    continue; // stop marker, it sorts before the subtree of its key
+                if (node.nodes[i] == 0 || (i + 1 < node.num && node.keys[i + 1] == key)) {
+                    if (id == 0) {
+                        buffer[depth] = key;
+                        buffer[depth + 1] = '\0';
+                        return depth + 1;
+                    }
+                    id--;
+                }
+                if (node.nodes[i] != 0) {
+                    if (id < node.counts[i])
+                        break;
+                    id -= node.counts[i];
+                }
+            }
+            if (i == node.num)
+                return 0; // past the last key
+            buffer[depth] = node.keys[i];
+            numStart = node.nodes[i];
+        }
+        return 0;
+    }
+
+    // the same on the codepoints before and after at, for PackUtf8 text starting at begin
+    static bool isBoundaryUtf8(const char* begin, const char* at)
+    {
+        const char before = at == begin ? 0 : at[-1];
+        if (!(before & 0x80) && !(*at & 0x80))
+            return isBoundary(before, *at);
+        const char32_t a = at == begin ? 0 : decodeUtf8Before(begin, at);
+        int len;
+        const char32_t b = decodeUtf8(at, len);
+        return !isIdentCodepoint(a) || !isIdentCodepoint(b);
+    }
+
+    // Reports every keyword of text that starts and ends on an identifier boundary, the
+    // longest one at each start, as onMatch(size_t offset, int len). Matches don't overlap.
+    template <typename OnMatch>
+    void scan(const char* text, OnMatch&& onMatch) const
+    {
+        // Between two bytes of an ASCII stretch the byte classes are the codepoint ones, so
+        // only around non-ASCII bytes does PackUtf8 decode; asciiPrefixLength() finds the end
+        // of each stretch.
+        const bool utf8 = m_flags & PackUtf8;
+        const char* asciiBegin = text;
+        const char* asciiEnd = utf8 ? text + asciiPrefixLength(text) : nullptr;
+        auto boundary = [&](const char* at) {
+            if (!utf8)
+                return isBoundary(at == text ? 0 : at[-1], *at);
+            if (at > asciiBegin && at < asciiEnd)
+                return isBoundary(at[-1], *at);
+            return isBoundaryUtf8(text, at);
+        };
+
+        for (const char* p = text; *p;) {
+            if (utf8 && p >= asciiEnd && !(*p & 0x80)) {
+                asciiBegin = p;
+                asciiEnd = p + asciiPrefixLength(p);
+            }
+            if (!(utf8 && utf8IsContinuation(*p)) && boundary(p)) {
+                const int len = matchImpl(p, boundary);
+                if (len) {
+                    onMatch(size_t(p - text), len);
+                    p += len;
+                    continue;
+                }
+            }
+            ++p;
+        }
+    }
+
+    // match() over text that arrives in pieces: the state is the node reached and the longest
+    // stop so far, so the chunks are fed in order with no reassembly copy.
+    class Cursor {
+        const BasicDenseTrie* m_trie = nullptr;
+        size_t m_node = 0;
+        int m_depth = 0;
+        int m_lenEnd = 0;
+        int m_pending = 0; // PackUtf8 stop, a match unless the next byte continues the codepoint
+        bool m_alive = false;
+
+        friend class BasicDenseTrie;
+
+    public:
+        // false once the path has left the trie or ended in a leaf, further chars are ignored
+        bool alive() const { return m_alive; }
+        // chars consumed on the path
+        int depth() const { return m_depth; }
+        // longest stop so far, what match() returns once the cursor is dead or the text ends
+        int length() const { return m_pending ? m_pending : m_lenEnd; }
+
+        // true if c was consumed
+        bool step(char c)
+        {
+            if (m_pending) {
+                if (!utf8IsContinuation(c))
+                    m_lenEnd = m_pending;
+                m_pending = 0;
+            }
+            if (!m_alive)
+                return false;
+            c = m_trie->queryChar(c);
+            const NodeView node = m_trie->nodeAt(m_node);
+            m_trie->countVisit(m_node, m_depth);
+
+            auto keysEnd = node.keys + node.num;
+            auto keyIt = std::lower_bound(node.keys, keysEnd, c, KeyLess());
+            if (keyIt == keysEnd || *keyIt != c) {
+                m_alive = false;
+                return false;
+            }
+
+            m_node = node.nodes[keyIt - node.keys];
+            m_depth++;
+            const bool leaf = m_node == 0;
+            if (leaf || (keyIt + 1 != keysEnd && keyIt[1] == c))
+                ((m_trie->m_flags & PackUtf8) ? m_pending : m_lenEnd) = m_depth;
+            if (leaf)
+                m_alive = false; // nothing to follow
+            return true;
+        }
+
+        // returns the number of chars of chunk consumed, less than size once the cursor dies
+        size_t feed(const char* chunk, size_t size)
+        {
+            size_t i = 0;
+            while (i < size && step(chunk[i]))
+                ++i;
+            return i;
+        }
+
+        void reset()
+        {
+            m_node = 0;
+            m_depth = m_lenEnd = m_pending = 0;
+            m_alive = !m_trie->m_data.empty();
+        }
+    };
+
+    Cursor cursor() const
+    {
+        Cursor cursor;
+        cursor.m_trie = this;
+        cursor.reset();
+        return cursor;
+    }
+
+    // scan() over a stream. Chunks are fed in order, each match is reported as
+    // onMatch(size_t offset in the stream, int len) as soon as no later byte can change it,
+    // finish() reports the rest at the end of the stream. A NUL byte is a separator here, not
+    // the end of the text. Every boundary still inside a possible key keeps a cursor, so the
+    // state is bounded by the longest key. With PackUtf8 the boundaries are those of
+    // isBoundaryUtf8(), decided once the codepoint after them is complete: a candidate or stop
+    // at the start of the current codepoint waits for it, at most 4 bytes.
+    class StreamScanner {
+        struct Candidate {
+            size_t start;
+            Cursor cursor;
+            int accepted; // longest stop followed by a boundary
+            int pending; // PackUtf8 stop ending at m_codepointStart, accepted if that is a boundary
+        };
+
+        const BasicDenseTrie* m_trie = nullptr;
+        std::vector<Candidate> m_candidates; // by start
+        size_t m_offset = 0; // of the next byte
+        size_t m_skip = 0; // matches don't overlap, no candidate starts before
+        char m_prev = 0;
+
+        // PackUtf8: the codepoint being received and whether the one before it is an identifier
+        size_t m_codepointStart = 0;
+        char m_codepoint[4] = {};
+        int m_codepointBytes = 0; // 0 with no codepoint open; stray continuations count on
+        bool m_identBefore = false;
+
+        friend class BasicDenseTrie;
+
+        bool utf8() const { return m_trie->m_flags & PackUtf8; }
+        bool continues(char c) const { return utf8() && utf8IsContinuation(c); }
+
+        // a stop ending at the current offset is accepted if c is a boundary after it; with
+        // PackUtf8 it waits for the codepoint c starts, the end is always a boundary
+        void acceptStops(char c)
+        {
+            for (auto& candidate : m_candidates) {
+                const int len = candidate.cursor.length();
+                if (!len || candidate.start + len != m_offset || continues(c))
+                    continue;
+                if (utf8() && c)
+                    candidate.pending = len;
+                else if (isBoundary(m_prev, c))
+                    candidate.accepted = len;
+            }
+        }
+
+        // The codepoint at m_codepointStart is complete, so whether that is a boundary is known:
+        // its pending stops are accepted or dropped, and so is the candidate starting there.
+        // The classes are those isBoundaryUtf8() decodes from the same bytes.
+        void closeCodepoint()
+        {
+            if (!m_codepointBytes)
+                return;
+            char bytes[5] = {};
+            std::copy(m_codepoint, m_codepoint + std::min(m_codepointBytes, 4), bytes);
+            int len;
+            const bool ident = isIdentCodepoint(decodeUtf8(bytes, len));
+            const bool boundary = !m_identBefore || !ident;
+
+            for (auto& candidate : m_candidates) {
+                if (candidate.pending && boundary)
+                    candidate.accepted = candidate.pending;
+                candidate.pending = 0;
+            }
+            if (!boundary && !m_candidates.empty() && m_candidates.back().start == m_codepointStart)
+                m_candidates.pop_back();
+
+            // a codepoint followed by stray continuations decodes as U+FFFD before the next one
+            m_identBefore = ident && len == m_codepointBytes;
+            m_codepointBytes = 0;
+        }
+
+        // reports the first candidates while they can't change any more
+        template <typename OnMatch>
+        void resolve(OnMatch& onMatch, bool atEnd)
+        {
+            size_t done = 0;
+            for (; done < m_candidates.size(); ++done) {
+                const Candidate& candidate = m_candidates[done];
+                if (candidate.start < m_skip)
+                    continue; // inside the last match
+                if (!atEnd && (candidate.cursor.alive() || candidate.start + candidate.cursor.length() >= m_offset))
+                    break;
+                if (candidate.pending || (utf8() && candidate.start == m_codepointStart && m_codepointBytes))
+                    break; // waits for closeCodepoint()
+                if (candidate.accepted) {
+                    onMatch(candidate.start, candidate.accepted);
+                    m_skip = candidate.start + candidate.accepted;
+                }
+            }
+            m_candidates.erase(m_candidates.begin(), m_candidates.begin() + done);
+        }
+
+    public:
+        template <typename OnMatch>
+        void feed(const char* chunk, size_t size, OnMatch&& onMatch)
+        {
+            for (size_t i = 0; i < size; ++i) {
+                const char c = chunk[i];
+                if (utf8() && !utf8IsContinuation(c))
+                    closeCodepoint();
+                acceptStops(c);
+                for (auto& candidate : m_candidates)
+                    candidate.cursor.step(c);
+
+                // with PackUtf8 every codepoint start is a candidate until closeCodepoint()
+                if (m_offset >= m_skip && (utf8() ? !utf8IsContinuation(c) : isBoundary(m_prev, c))) {
+                    Candidate candidate { m_offset, m_trie->cursor(), 0, 0 };
+                    if (candidate.cursor.step(c))
+                        m_candidates.push_back(candidate);
+                }
+                if (utf8() && !utf8IsContinuation(c)) {
+                    m_codepointStart = m_offset;
+                    m_codepoint[0] = c;
+                    m_codepointBytes = 1;
+                } else if (m_codepointBytes) {
+                    if (m_codepointBytes < 4)
+                        m_codepoint[m_codepointBytes] = c;
+                    m_codepointBytes = std::min(m_codepointBytes + 1, 5); // too long either way
+                } else if (utf8()) {
+                    m_identBefore = false; // continuation with no lead
+                }
+                m_prev = c;
+                m_offset++;
+                resolve(onMatch, false);
+            }
+        }
+
+        // the end of the stream is a boundary, reports the pending matches and starts a new stream
+        template <typename OnMatch>
+        void finish(OnMatch&& onMatch)
+        {
+            closeCodepoint();
+            acceptStops(0);
+            resolve(onMatch, true);
+            m_offset = m_skip = 0;
+            m_prev = 0;
+            m_identBefore = false;
+        }
+
+        // bytes fed since the start of the stream
+        size_t offset() const { return m_offset; }
+    };
+
+    StreamScanner streamScanner() const
+    {
+        StreamScanner scanner;
+        scanner.m_trie = this;
+        return scanner;
+    }
+
+    // Streams the keys starting with prefix in the order of the packed keys (KeyLess, by unsigned byte)
+    // as onKey(const char* key, size_t len), at most limit of them. Each key is written into the
+    // caller's buffer, which is reused for the next one; keys of bufferSize or more chars are
+    // skipped. Returns the number of keys reported.
+    template <typename OnKey>
+    size_t complete(const char* prefix, char* buffer, size_t bufferSize, size_t limit, OnKey&& onKey) const
+    {
+        const size_t prefixLen = strlen(prefix);
+        const PrefixNode found = findPrefix(prefix);
+        if (!found.found || limit == 0 || prefixLen >= bufferSize)
+            return 0;
+
+        memcpy(buffer, prefix, prefixLen + 1);
+        for (size_t i = 0; i < prefixLen; ++i)
+            buffer[i] = queryChar(buffer[i]);
+        size_t count = 0;
+        if (found.isKey) {
+            onKey((const char*)buffer, prefixLen);
+            if (++count == limit || !found.hasSubtree)
+                return count;
+        }
+        completeFrom(found.node, buffer, bufferSize, prefixLen, limit, count, onKey);
+        return count;
+    }
+
+    // The k best scored keys starting with prefix, best first, as
+    // onKey(const char* key, size_t len, ScoreType score) with the key in the caller's buffer.
+    // Needs an image packed with PackScores. Best-first search over the subtree maxima: a subtree
+    // is expanded only while its max can still beat the k-th result, so the cost follows k and
+    // the key length rather than the number of completions.
+    template <typename OnKey>
+    size_t topK(const char* prefix, char* buffer, size_t bufferSize, size_t k, OnKey&& onKey) const
+    {
+        const size_t prefixLen = strlen(prefix);
+        const PrefixNode found = findPrefix(prefix);
+        if (!(m_flags & PackScores) || !found.found || k == 0 || prefixLen >= bufferSize)
+            return 0;
+
+        constexpr uint32_t noPath = ~0u;
+        struct Path {
+            KeyType key;
+            uint32_t parent; // chars after the prefix, back to front
+            uint32_t length;
+        };
+        struct Candidate {
+            ScoreType score;
+            uint32_t order; // ties in discovery order
+            uint32_t path;
+            IndexType node;
+            bool isKey;
+            bool operator<(const Candidate& other) const
+            {
+                return score != other.score ? score < other.score : order > other.order;
+            }
+        };
+        std::vector<Path> paths;
+        std::vector<Candidate> queue; // max heap
+        uint32_t order = 0;
+        auto push = [&](ScoreType score, uint32_t path, size_t node, bool isKey) {
+            queue.push_back({ score, order++, path, IndexType(node), isKey });
+            std::push_heap(queue.begin(), queue.end());
+        };
+
+        if (found.isKey)
+            push(found.keyScore, noPath, 0, true);
+        if (found.hasSubtree)
+            push(found.maxScore, noPath, found.node, false);
+
+        memcpy(buffer, prefix, prefixLen + 1);
+        for (size_t i = 0; i < prefixLen; ++i)
+            buffer[i] = queryChar(buffer[i]);
+        size_t count = 0;
+        while (!queue.empty() && count < k) {
+            std::pop_heap(queue.begin(), queue.end());
+            const Candidate candidate = queue.back();
+            queue.pop_back();
+
+            if (candidate.isKey) {
+                const size_t len = prefixLen + (candidate.path == noPath ? 0 : paths[candidate.path].length);
+                if (len >= bufferSize)
+                    continue;
+                buffer[len] = '\0';
+                for (uint32_t p = candidate.path; p != noPath; p = paths[p].parent)
+                    buffer[prefixLen + paths[p].length - 1] = paths[p].key;
+                onKey((const char*)buffer, len, candidate.score);
+                count++;
+                continue;
+            }
+
+            const NodeView node = nodeAt(candidate.node);
+            const uint32_t parentLength = candidate.path == noPath ? 0 : paths[candidate.path].length;
+            for (size_t i = 0; i < node.num; ++i) {
+                if (i > 0 && node.keys[i - 1] == node.keys[i])
+                    continue; // stop marker, pushed with its subtree entry
+
+                const uint32_t path = (uint32_t)paths.size();
+                paths.push_back({ node.keys[i], candidate.path, parentLength + 1 });
+                if (node.nodes[i] == 0) {
+                    push(node.scores[i], path, 0, true);
+                    continue;
+                }
+                if (i + 1 < node.num && node.keys[i + 1] == node.keys[i])
+                    push(node.scores[i + 1], path, 0, true);
+                push(node.scores[i], path, node.nodes[i], false);
+            }
+        }
+        return count;
+    }
+
+    // Every key within Levenshtein distance maxDistance of query, in key order, as
+    // onKey(const char* key, size_t len, int distance) with the key in the caller's buffer.
+    // Walks the trie with one DP row per depth and leaves a subtree once every cell of its row
+    // exceeds maxDistance, so only the keys near the query are visited.
+    template <typename OnKey>
+    size_t fuzzy(const char* query, int maxDistance, char* buffer, size_t bufferSize, OnKey&& onKey) const
+    {
+        if (m_data.empty() || maxDistance < 0 || bufferSize == 0)
+            return 0;
+
+        const size_t queryLen = strlen(query);
+        // row of depth d holds the distances of the d-char key prefix to every query prefix
+        std::vector<int> rows(queryLen + 1);
+        for (size_t j = 0; j <= queryLen; ++j)
+            rows[j] = (int)j;
+
+        size_t count = 0;
+        fuzzyFrom(0, query, queryLen, maxDistance, rows, 0, buffer, bufferSize, count, onKey);
+        return count;
+    }
+
+    // Every key matching a glob pattern, in key order, as onKey(const char* key, size_t len) with the
+    // key in the caller's buffer. '?' is any char, '*' any run of chars, [abc], [a-c] and [^a-c]
+    // or [!a-c] a class, '\\' escapes. The pattern runs as an NFA alongside the walk, so only
+    // subtrees that can still match are entered. Returns 0 for a malformed pattern or one of more
+    // than 63 items.
+    template <typename OnKey>
+    size_t wildcard(const char* pattern, char* buffer, size_t bufferSize, OnKey&& onKey) const
+    {
+        std::vector<PatternItem> items;
+        if (m_data.empty() || bufferSize == 0 || !compilePattern(pattern, m_flags & PackFoldCase, items))
+            return 0;
+
+        size_t count = 0;
+        wildcardFrom(0, items, patternClosure(items, 1), 0, buffer, bufferSize, count, onKey);
+        return count;
+    }
+
+    // Bidirectional iterator over the keys in packed order, lexicographic by unsigned byte as
+    // in a std::set<std::string>. The key is
+    // rebuilt in a buffer owned by the iterator and reused on every step. end() is one past the
+    // last key, --end() is the last key and --begin() is end().
+    class Iterator {
+        struct Frame {
+            IndexType node;
+            uint32_t entry; // first entry of a key group; a stop in the last frame, a subtree in the others
+        };
+
+        const BasicDenseTrie* m_trie = nullptr;
+        std::vector<Frame> m_frames; // empty at end()
+        std::string m_key;
+
+        friend class BasicDenseTrie;
+
+        NodeView node(const Frame& frame) const { return m_trie->nodeAt(frame.node); }
+
+        static bool isStop(const NodeView& node, size_t entry)
+        {
+            return node.nodes[entry] == 0 || (entry + 1 < node.num && node.keys[entry + 1] == node.keys[entry]);
+        }
+
+        static size_t nextGroup(const NodeView& node, size_t entry)
+        {
+            return entry + ((entry + 1 < node.num && node.keys[entry + 1] == node.keys[entry]) ? 2 : 1);
+        }
+
+        static size_t prevGroup(const NodeView& node, size_t entry) // entry > 0
+        {
+            return (entry >= 2 && node.keys[entry - 2] == node.keys[entry - 1]) ? entry - 2 : entry - 1;
+        }
+
+        void push(size_t numStart, size_t entry)
+        {
+            m_frames.push_back({ IndexType(numStart), uint32_t(entry) });
+            m_key.push_back(m_trie->nodeAt(numStart).keys[entry]);
+        }
+
+        void pop()
+        {
+            m_frames.pop_back();
+            m_key.pop_back();
+        }
+
+        // smallest key of the group at frames.back()
+        void descendFirst()
+        {
+            while (true) {
+                const NodeView current = node(m_frames.back());
+                const size_t entry = m_frames.back().entry;
+                if (isStop(current, entry))
+                    return;
+                push(current.nodes[entry], 0);
+            }
+        }
+
+        // largest key of the group at frames.back(), always a leaf
+        void descendLast()
+        {
+            while (true) {
+                const NodeView current = node(m_frames.back());
+                const size_t child = current.nodes[m_frames.back().entry];
+                if (child == 0)
+                    return;
+                const NodeView childNode = m_trie->nodeAt(child);
+                push(child, childNode.num >= 2 && childNode.keys[childNode.num - 2] == childNode.keys[childNode.num - 1] ? childNode.num - 2 : childNode.num - 1);
+            }
+        }
+
+        // first key after the subtree of frames.back()
+        void advance()
+        {
+            while (!m_frames.empty()) {
+                Frame& frame = m_frames.back();
+                const NodeView current = node(frame);
+                const size_t next = nextGroup(current, frame.entry);
+                if (next < current.num) {
+                    frame.entry = uint32_t(next);
+                    m_key.back() = current.keys[next];
+                    descendFirst();
+                    return;
+                }
+                pop();
+            }
+        }
+
+        void seekFirst()
+        {
+            m_frames.clear();
+            m_key.clear();
+            if (!m_trie->m_data.empty() && m_trie->nodeAt(0).num) {
+                push(0, 0);
+                descendFirst();
+            }
+        }
+
+        void seekLast()
+        {
+            m_frames.clear();
+            m_key.clear();
+            const NodeView root = m_trie->m_data.empty() ? NodeView {} : m_trie->nodeAt(0);
+            if (root.num) {
+                push(0, root.num >= 2 && root.keys[root.num - 2] == root.keys[root.num - 1] ? root.num - 2 : root.num - 1);
+                descendLast();
+            }
+        }
+
+        // key is folded char by char with PackFoldCase
+        void seekLowerBound(const char* key)
+        {
+            m_frames.clear();
+            m_key.clear();
+            if (m_trie->m_data.empty() || !*key) {
+                seekFirst();
+                return;
+            }
+
+            size_t numStart = 0;
+            for (const char* p = key;; ++p) {
+                const char c = m_trie->queryChar(*p);
+                const NodeView current = m_trie->nodeAt(numStart);
+                const size_t entry = std::lower_bound(current.keys, current.keys + current.num, c, KeyLess()) - current.keys;
+                if (entry == current.num) {
+                    advance(); // every key of this node is smaller
+                    return;
+                }
+
+                push(numStart, entry);
+                if (current.keys[entry] != c || !p[1]) {
+                    descendFirst(); // greater char, or key itself / its first extension
+                    return;
+                }
+                if (current.nodes[entry] == 0) {
+                    advance(); // a leaf that is a proper prefix of key
+                    return;
+                }
+                // a stop here would be a smaller proper prefix of key
+                numStart = current.nodes[entry];
+            }
+        }
+
+    public:
+        bool valid() const { return !m_frames.empty(); }
+        const std::string& key() const { return m_key; }
+        const std::string& operator*() const { return m_key; }
+        const std::string* operator->() const { return &m_key; }
+
+        bool operator==(const Iterator& other) const
+        {
+            if (m_frames.size() != other.m_frames.size())
+                return false;
+            for (size_t i = 0; i < m_frames.size(); ++i)
+                if (m_frames[i].node != other.m_frames[i].node || m_frames[i].entry != other.m_frames[i].entry)
+                    return false;
+            return true;
+        }
+        bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+        Iterator& operator++()
+        {
+            if (m_frames.empty())
+                return *this;
+            const NodeView current = node(m_frames.back());
+            const size_t child = current.nodes[m_frames.back().entry];
+            if (child != 0) {
+                push(child, 0); // keys below a stop follow it
+                descendFirst();
+            } else {
+                advance();
+            }
+            return *this;
+        }
+
+        Iterator& operator--()
+        {
+            if (m_frames.empty()) {
+                seekLast();
+                return *this;
+            }
+            while (!m_frames.empty()) {
+                Frame& frame = m_frames.back();
+                const NodeView current = node(frame);
+                if (frame.entry > 0) {
+                    frame.entry = uint32_t(prevGroup(current, frame.entry));
+                    m_key.back() = current.keys[frame.entry];
+                    descendLast();
+                    return *this;
+                }
+                pop();
+                // the parent's stop precedes its subtree
+                if (!m_frames.empty() && isStop(node(m_frames.back()), m_frames.back().entry))
+                    return *this;
+            }
+            return *this;
+        }
+    };
+
+    Iterator begin() const
+    {
+        Iterator it;
+        it.m_trie = this;
+        it.seekFirst();
+        return it;
+    }
+
+    Iterator end() const
+    {
+        Iterator it;
+        it.m_trie = this;
+        return it;
+    }
+
+    // first key not less than key
+    Iterator lowerBound(const char* key) const
+    {
+        Iterator it = end();
+        it.seekLowerBound(key);
+        return it;
+    }
+
+    // first key greater than key
+    Iterator upperBound(const char* key) const
+    {
+        Iterator it = end();
+        it.seekLowerBound(key);
+        if (it.valid() && compareQuery(it.key(), key) == 0)
+            ++it;
+        return it;
+    }
+
+    // keys in [from, to) as onKey(const std::string& key), returns their number
+    template <typename OnKey>
+    size_t range(const char* from, const char* to, OnKey&& onKey) const
+    {
+        size_t count = 0;
+        for (Iterator it = lowerBound(from); it.valid() && compareQuery(it.key(), to) < 0; ++it, ++count)
+            onKey(it.key());
+        return count;
+    }
+
+    // order of the packed keys (KeyLess), the order of std::string
+    static bool keyLess(std::string_view a, std::string_view b) { return a < b; }
+
+    // Proves that every node reachable from the root lies inside the image, its keys are
+    // sorted, only the root may be empty and child offsets contain no cycles, so nodeAt()
+    // never leaves the buffer. With PackFoldCase every key must be lowercase.
+    static bool validate(const uint8_t* data, size_t size, uint8_t flags)
+    {
+        const size_t root = 0;
+        return size == 0 || validateRoots(data, size, flags, &root, 1);
+    }
+
+    // the same for an image with several roots, nodes may be shared between them
+    static bool validateRoots(const uint8_t* data, size_t size, uint8_t flags, const size_t* roots, size_t numRoots)
+    {
+        // two bits per image byte, a node by its first one: a quarter of the image size
+        enum : uint8_t { Unvisited, InProgress, Done };
+        std::vector<uint64_t> states((size + 31) / 32, 0);
+        auto state = [&](size_t at) { return uint8_t(states[at / 32] >> (at % 32 * 2) & 3); };
+        auto setState = [&](size_t at, uint8_t value) {
+            const unsigned shift = at % 32 * 2;
+            states[at / 32] = (states[at / 32] & ~(uint64_t(3) << shift)) | uint64_t(value) << shift;
+        };
+        std::vector<std::pair<size_t, size_t>> stack; // node offset, next child to visit
+
+        auto checkNode = [&](size_t numStart) {
+            if (numStart + sizeof(NumType) > size)
+                return false;
+            const NumType num = *(const NumType*)(data + numStart);
+            const size_t keyStart = numStart + sizeof(NumType);
+            const size_t childNodeStart = nodesStart(keyStart, num);
+            if (nodeEnd(numStart, num, flags) > size)
+                return false;
+
+            const KeyType* keys = (const KeyType*)(data + keyStart);
+            const IndexType* nodes = (const IndexType*)(data + childNodeStart);
+            for (size_t i = 1; i < num; ++i) {
+                if (KeyLess()(keys[i], keys[i - 1]))
+                    return false;
+                // duplicate key marks a stop on an inner node: {child, 0}
+                if (keys[i - 1] == keys[i] && (nodes[i - 1] == 0 || nodes[i] != 0 || (i > 1 && keys[i - 2] == keys[i])))
+                    return false;
+            }
+            // an uppercase key could never be reached by a folded query
+            for (size_t i = 0; i < num && (flags & PackFoldCase); ++i)
+                if (foldCase(keys[i]) != keys[i])
+                    return false;
+            return true;
+        };
+
+        for (size_t r = 0; r < numRoots; ++r) {
+            const size_t root = roots[r];
+            if (root < size && state(root) == Done)
+                continue;
+            if (!checkNode(root))
+                return false;
+            setState(root, InProgress);
+            stack.push_back({ root, 0 });
+            while (!stack.empty()) {
+                auto& [numStart, childIndex] = stack.back();
+                const NumType num = *(const NumType*)(data + numStart);
+                if (childIndex == num) {
+                    setState(numStart, Done);
+                    stack.pop_back();
+                    continue;
+                }
+
+                const size_t keyStart = numStart + sizeof(NumType);
+                const IndexType* nodes = (const IndexType*)(data + nodesStart(keyStart, num));
+                const size_t child = nodes[childIndex++];
+                if (child == 0)
+                    continue;
+                // a child without entries would leave an iterator nothing to descend into;
+                // the writers turn an empty subtree into a leaf
+                if (child >= size || *(const NumType*)(data + child) == 0)
+                    return false;
+                if (state(child) == Done)
+                    continue;
+                if (state(child) == InProgress || !checkNode(child))
+                    return false;
+
+                setState(child, InProgress);
+                stack.push_back({ child, 0 });
+            }
+        }
+        return true;
+    }
+
+    // false, leaving the trie empty, if a node has more entries than NumType counts, the image
+    // outgrows IndexType offsets (WideDenseTrie takes any size) or doesn't validate
+    bool pack(const TrieNode& root, uint8_t flags = 0)
+    {
+        m_data.clear();
+        m_flags = flags;
+        m_packedRoot = nullptr;
+        PackedNode packed;
+        const bool ok = packNode(root, packed);
+        // an offset past the limit was truncated when it was written
+        if (!ok || m_data.size() > std::numeric_limits<IndexType>::max() || !validate(m_data.data(), m_data.size(), m_flags)) {
+            m_data.clear();
+            root.packedAt = nextImageId(); // the dirty flags now match no image, repack() packs fully
+            return false;
+        }
+        m_imageId = nextImageId();
+        root.packedAt = m_imageId;
+        root.dirty = false;
+        m_packedRoot = &root;
+        m_garbage = 0;
+        m_rootCapacity = nodeEnd(0, nodeAt(0).num, m_flags);
+        resetNodeStats();
+        return true;
+    }
+
+    // Delta pack of the trie this image was packed from last: only the nodes changed since
+    // (TrieNode::dirty) are written, appended to the image after their children, and the
+    // parents on their path point to the new copies; untouched subtrees stay where they are.
+    // The root stays at offset 0 and is rewritten in place while it fits its first slot.
+    // Replaced nodes become garbage; once it exceeds maxGarbage of the image, or the root
+    // outgrows its slot, or root wasn't packed by this DenseTrie, it falls back to pack().
+    // Another DenseTrie packing the same trie in between also means a full pack.
+    bool repack(const TrieNode& root, double maxGarbage = 0.5)
+    {
+        if (m_packedRoot != &root || root.packedAt != m_imageId || m_data.empty())
+            return pack(root, m_flags);
+        if (!root.dirty)
+            return true;
+
+        // a copy of this DenseTrie holding the old id now takes the full pack
+        m_imageId = nextImageId();
+        PackedNode packed;
+        if (!repackNode(root, packed) || m_garbage > maxGarbage * m_data.size())
+            return pack(root, m_flags);
+        resetNodeStats();
+        return true;
+    }
+
+    // bytes of the image no node uses since the last pack()
+    size_t garbageBytes() const { return m_garbage; }
+
+    // Packs `a op b` straight from the two images, e.g. a shared base dictionary plus tenant
+    // overrides, without re-inserting keys into a Trie. The images are walked in lockstep and
+    // only the subtrees the result draws from are visited; nodes are written children first
+    // since an intersection or difference may leave a subtree empty, the root into a slot
+    // reserved at offset 0. Scores are read from inputs packed with PackScores, 0 otherwise.
+    // A Trie is combined by packing it first. a or b may be *this. false, leaving the trie
+    // empty, if the result can't be packed (a node of more than 255 entries).
+    bool combine(const BasicDenseTrie& a, const BasicDenseTrie& b, SetOperation op, uint8_t flags = 0)
+    {
+        const BasicDenseTrie* rootA = a.m_data.empty() ? nullptr : &a;
+        const BasicDenseTrie* rootB = b.m_data.empty() ? nullptr : &b;
+        size_t rootBound = rootA ? rootA->nodeAt(0).num : 0;
+        if (op == SetOperation::Union && rootB)
+            rootBound += rootB->nodeAt(0).num;
+
+        BasicDenseTrie result;
+        result.useHugePages(usesHugePages());
+        result.m_flags = flags;
+        result.m_rootCapacity = nodeEnd(0, std::min<size_t>(rootBound, std::numeric_limits<NumType>::max()), flags);
+        result.m_data.resize(result.m_rootCapacity);
+        IndexType offset;
+        PackedNode packed;
+        const bool ok = result.combineNode(rootA, 0, rootB, 0, op, true, offset, packed);
+
+        m_data.swap(result.m_data);
+        m_flags = flags;
+        m_packedRoot = nullptr;
+        if (!ok || !validate(m_data.data(), m_data.size(), m_flags)) {
+            m_data.clear();
+            return false;
+        }
+        resetNodeStats();
+        return true;
+    }
+
+    bool save(const char* path) const
+    {
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(m_data.data(), 1, m_data.size(), f) == m_data.size();
+        return fclose(f) == 0 && ok;
+    }
+
+    // image is accepted only if it validates, a corrupted file leaves the trie empty
+    bool load(const char* path, uint8_t flags = 0)
+    {
+        m_data.clear();
+        m_flags = flags;
+        m_packedRoot = nullptr;
+        if (!readFile(path, m_data) || !validate(m_data.data(), m_data.size(), m_flags)) {
+            m_data.clear();
+            return false;
+        }
+        resetNodeStats();
+        return true;
+    }
+
+    void resetNodeStats()
+    {
+#ifdef TRIE_NODE_STATS
+        m_nodeVisits.clear();
+        m_depthVisits.clear();
+#endif
+    }
+
+#ifdef TRIE_NODE_STATS
+    uint64_t nodeVisits(size_t numStart) const
+    {
+        auto it = m_nodeVisits.find(numStart);
+        return it == m_nodeVisits.end() ? 0 : it->second;
+    }
+
+    // Visits per depth, then the maxNodes hottest nodes with the prefix leading to them:
+    //     visits  offset  depth  prefix
+    void dumpHeatmap(FILE* out, size_t maxNodes) const
+    {
+        uint64_t total = 0;
+        for (uint64_t visits : m_depthVisits)
+            total += visits;
+
+        fprintf(out, "depth      visits   share\n");
+        for (size_t depth = 0; depth < m_depthVisits.size(); ++depth)
+            fprintf(out, "%5zu %11llu %6.2f%%\n", depth, (unsigned long long)m_depthVisits[depth],
+                total ? 100.0 * m_depthVisits[depth] / total : 0.0);
+
+        if (m_data.empty())
+            return;
+
+        struct HotNode {
+            uint64_t visits;
+            size_t numStart;
+            std::string prefix;
+        };
+        std::vector<HotNode> hot;
+        std::string prefix;
+        forEachNode(0, prefix, [&](size_t numStart, const std::string& nodePrefix) {
+            if (uint64_t visits = nodeVisits(numStart))
+                hot.push_back({ visits, numStart, nodePrefix });
+        });
+        std::sort(hot.begin(), hot.end(), [](const HotNode& a, const HotNode& b) { return a.visits > b.visits; });
+
+        fprintf(out, "     visits     offset  depth  prefix\n");
+        for (size_t i = 0; i < hot.size() && i < maxNodes; ++i)
+            fprintf(out, "%11llu %10zu %6zu  \"%s\"\n", (unsigned long long)hot[i].visits, hot[i].numStart,
+                hot[i].prefix.size(), hot[i].prefix.c_str());
+    }
+#endif
+
+private:
+    struct PatternItem {
+        enum Kind : uint8_t { Literal, Any, Star, Class } kind;
+        char literal;
+        uint64_t chars[4]; // Class, bit per unsigned char
+
+        bool matches(char c) const
+        {
+            const unsigned char u = (unsigned char)c;
+            switch (kind) {
+            case Literal: return c == literal;
+            case Any: return true;
+            case Class: return (chars[u / 64] >> (u % 64)) & 1;
+            case Star: return false;
+            }
+            return false;
+        }
+    };
+
+    // with foldCase literals and classes are lowered to match folded keys
+    static bool compilePattern(const char* pattern, bool foldCase, std::vector<PatternItem>& items)
+    {
+        for (const char* p = pattern; *p; ++p) {
+            PatternItem item {};
+            if (*p == '?') {
+                item.kind = PatternItem::Any;
+            } else if (*p == '*') {
+                if (!items.empty() && items.back().kind == PatternItem::Star)
+                    continue; // ** is *
+                item.kind = PatternItem::Star;
+            } else if (*p == '[') {
+                item.kind = PatternItem::Class;
+                const bool negate = p[1] == '^' || p[1] == '!';
+                p += negate ? 2 : 1;
+                for (bool first = true; *p && (*p != ']' || first); ++p, first = false) {
+                    unsigned char from = (unsigned char)*p, to = from;
+                    if (p[1] == '-' && p[2] && p[2] != ']') {
+                        to = (unsigned char)p[2];
+                        p += 2;
+                    }
+                    for (unsigned c = from; c <= to; ++c)
+                        item.chars[c / 64] |= uint64_t(1) << (c % 64);
+                }
+                if (*p != ']')
+                    return false; // unterminated class
+                for (unsigned c = 'A'; foldCase && c <= 'Z'; ++c)
+                    if ((item.chars[c / 64] >> (c % 64)) & 1)
+                        item.chars[(c + 32) / 64] |= uint64_t(1) << ((c + 32) % 64);
+                if (negate)
+                    for (auto& bits : item.chars)
+                        bits = ~bits;
+            } else {
+                if (*p == '\\' && p[1])
+                    ++p;
+                item.kind = PatternItem::Literal;
+                item.literal = foldCase ? ::foldCase(*p) : *p;
+            }
+            items.push_back(item);
+        }
+        return items.size() < 64;
+    }
+
+    // adds the states reachable by letting a '*' match nothing
+    static uint64_t patternClosure(const std::vector<PatternItem>& items, uint64_t states)
+    {
+        for (size_t i = 0; i < items.size(); ++i)
+            if (((states >> i) & 1) && items[i].kind == PatternItem::Star)
+                states |= uint64_t(1) << (i + 1);
+        return states;
+    }
+
+    static uint64_t patternStep(const std::vector<PatternItem>& items, uint64_t states, char c)
+    {
+        uint64_t next = 0;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (!((states >> i) & 1))
+                continue;
+            if (items[i].kind == PatternItem::Star)
+                next |= uint64_t(1) << i;
+            else if (items[i].matches(c))
+                next |= uint64_t(1) << (i + 1);
+        }
+        return patternClosure(items, next);
+    }
+
+    template <typename OnKey>
+    void wildcardFrom(size_t numStart, const std::vector<PatternItem>& items, uint64_t states, size_t depth,
+        char* buffer, size_t bufferSize, size_t& count, OnKey& onKey) const
+    {
+        if (depth + 1 >= bufferSize)
+            return; // every key below is too long
+
+        const uint64_t accept = uint64_t(1) << items.size();
+        const NodeView node = nodeAt(numStart);
+        size_t begin = 0, end = node.num;
+
+        // a single literal state only needs the entries of that char
+        if ((states & (states - 1)) == 0 && states != accept) {
+            const PatternItem& item = items[std::countr_zero(states)];
+            if (item.kind == PatternItem::Literal) {
+                begin = std::lower_bound(node.keys, node.keys + node.num, item.literal, KeyLess()) - node.keys;
+                end = std::upper_bound(node.keys, node.keys + node.num, item.literal, KeyLess()) - node.keys;
+            }
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            const char key = node.keys[i];
+            if (i > 0 && node.keys[i - 1] == key)
+                continue; // stop marker, handled with the subtree entry
+
+            const uint64_t next = patternStep(items, states, key);
+            if (!next)
+                continue;
+
+            buffer[depth] = key;
+            buffer[depth + 1] = '\0';
+            const bool stop = node.nodes[i] == 0 || (i + 1 < node.num && node.keys[i + 1] == key);
+            if (stop && (next & accept)) {
+                onKey((const char*)buffer, depth + 1);
+                count++;
+            }
+            if (node.nodes[i] != 0 && (next & ~accept))
+                wildcardFrom(node.nodes[i], items, next, depth + 1, buffer, bufferSize, count, onKey);
+        }
+    }
+
+    template <typename OnKey>
+    void fuzzyFrom(size_t numStart, const char* query, size_t queryLen, int maxDistance, std::vector<int>& rows,
+        size_t depth, char* buffer, size_t bufferSize, size_t& count, OnKey& onKey) const
+    {
+        if (depth + 1 >= bufferSize)
+            return; // every key below is too long
+
+        const size_t width = queryLen + 1;
+        if (rows.size() < (depth + 2) * width)
+            rows.resize((depth + 2) * width);
+
+        const NodeView node = nodeAt(numStart);
+        for (size_t i = 0; i < node.num; ++i) {
+            const char key = node.keys[i];
+            if (i > 0 && node.keys[i - 1] == key)
+                continue; // stop marker, handled with the subtree entry
+
+            const int* prev = &rows[depth * width];
+            int* row = &rows[(depth + 1) * width];
+            row[0] = (int)depth + 1;
+            int rowMin = row[0];
+            for (size_t j = 1; j <= queryLen; ++j) {
+                row[j] = std::min({ prev[j] + 1, row[j - 1] + 1, prev[j - 1] + (queryChar(query[j - 1]) != key) });
+                rowMin = std::min(rowMin, row[j]);
+            }
+
+            buffer[depth] = key;
+            buffer[depth + 1] = '\0';
+            const bool stop = node.nodes[i] == 0 || (i + 1 < node.num && node.keys[i + 1] == key);
+            if (stop && row[queryLen] <= maxDistance) {
+                onKey((const char*)buffer, depth + 1, row[queryLen]);
+                count++;
+            }
+            if (node.nodes[i] != 0 && rowMin <= maxDistance)
+                fuzzyFrom(node.nodes[i], query, queryLen, maxDistance, rows, depth + 1, buffer, bufferSize, count, onKey);
+        }
+    }
+
+    struct PrefixNode {
+        bool found = false;
+        size_t node = 0; // subtree below the prefix
+        bool hasSubtree = false; // node is 0 both for the root and for no subtree
+        bool isKey = false; // the prefix itself is a key
+        ScoreType keyScore = 0; // with PackScores
+        ScoreType maxScore = ~ScoreType(0); // bound of the subtree, unknown for the root
+    };
+
+    PrefixNode findPrefix(const char* prefix) const
+    {
+        PrefixNode result;
+        if (m_data.empty())
+            return result;
+
+        for (const char* p = prefix; *p; ++p) {
+            if (result.node == 0 && p != prefix)
+                return {}; // went past a leaf
+
+            const char c = queryChar(*p);
+            const NodeView node = nodeAt(result.node);
+            auto keysEnd = node.keys + node.num;
+            auto keyIt = std::lower_bound(node.keys, keysEnd, c, KeyLess());
+            if (keyIt == keysEnd || *keyIt != c)
+                return {};
+
+            const size_t index = keyIt - node.keys;
+            result.node = node.nodes[index];
+            const bool duplicate = keyIt + 1 != keysEnd && keyIt[1] == c;
+            result.isKey = result.node == 0 || duplicate;
+            if (node.scores) {
+                result.maxScore = node.scores[index];
+                result.keyScore = node.scores[duplicate ? index + 1 : index];
+            }
+        }
+        result.found = true;
+        result.hasSubtree = result.node != 0 || *prefix == '\0';
+        return result;
+    }
+
+    // false once limit keys were reported
+    template <typename OnKey>
+    bool completeFrom(size_t numStart, char* buffer, size_t bufferSize, size_t depth, size_t limit, size_t& count, OnKey& onKey) const
+    {
+        if (depth + 1 >= bufferSize)
+            return true; // every key below is too long
+
+        const NodeView node = nodeAt(numStart);
+        for (size_t i = 0; i < node.num; ++i) {
+            const char key = node.keys[i];
+            if (i > 0 && node.keys[i - 1] == key)
+                continue; // stop marker, reported before the subtree
+
+            buffer[depth] = key;
+            buffer[depth + 1] = '\0';
+            if (node.nodes[i] == 0 || (i + 1 < node.num && node.keys[i + 1] == key)) {
+                onKey((const char*)buffer, depth + 1);
+                if (++count == limit)
+                    return false;
+            }
+            if (node.nodes[i] != 0 && !completeFrom(node.nodes[i], buffer, bufferSize, depth + 1, limit, count, onKey))
+                return false;
+        }
+        return true;
+    }
+
+    // longest stop on the path for which accept(end of the stop) holds
+    template <typename Accept>
+    int matchImpl(const char* text, Accept&& accept) const
+    {
+        int lenEnd = 0;
+        walk(text, [&](const char* end) {
+            if (accept(end))
+                lenEnd = int(end - text);
+            return true;
+        });
+        return lenEnd;
+    }
+
+    // onStop(const char* end of the stop) for every stop on the path, shortest first,
+    // until it returns false; root is another node for the images of MultiDenseTrie
+    template <typename OnStop>
+    void walk(const char* text, OnStop&& onStop, size_t root = 0) const
+    {
+        if (m_flags & PackUtf8) {
+            // a stop followed by a continuation byte ends inside a codepoint
+            auto onCodepointEnd = [&](const char* end) { return utf8IsContinuation(*end) || onStop(end); };
+            walkFolded(text, onCodepointEnd, root);
+        } else {
+            walkFolded(text, onStop, root);
+        }
+    }
+
+    template <typename OnStop>
+    void walkFolded(const char* text, OnStop& onStop, size_t root) const
+    {
+        if (m_flags & PackFoldCase)
+            walkImpl<true>(text, onStop, root);
+        else
+            walkImpl<false>(text, onStop, root);
+    }
+
+    // the fold is resolved at compile time, the plain walk pays nothing for it
+    template <bool FoldCase, typename OnStop>
+    void walkImpl(const char* text, OnStop& onStop, size_t root) const
+    {
+        if (m_data.empty())
+            return;
+
+        const char* const begin = text;
+        size_t currentNode = root;
+
+        while (*text) {
+            const char c = FoldCase ? foldCase(*text) : *text;
+            // retrieve child nodes
+            const NodeView node = nodeAt(currentNode);
+            countVisit(currentNode, size_t(text - begin));
+
+            auto keysEnd = node.keys + node.num;
+            auto keyIt = std::lower_bound(node.keys, keysEnd, c, KeyLess());
+            if (keyIt == keysEnd || *keyIt != c) {
+                break; // not found
+            }
+
+            currentNode = node.nodes[keyIt - node.keys];
+            ++text;
+
+            if (currentNode == 0) {
+                onStop(text); // leaf, nothing to follow
+                return;
+            }
+
+            auto nextKeyIt = keyIt + 1;
+            if (nextKeyIt != keysEnd && *keyIt == *nextKeyIt && !onStop(text)) {
+                return;
+            }
+        }
+    }
+
+    // walk() over an image with counts, onStop(const char* end, size_t rank of the stop);
+    // reports nothing without PackCounts
+    template <typename OnStop>
+    void walkRanked(const char* text, OnStop&& onStop) const
+    {
+        if (!(m_flags & PackCounts) || m_data.empty())
+            return;
+
+        const bool utf8 = m_flags & PackUtf8;
+        size_t currentNode = 0, rank = 0;
+        while (*text) {
+            const char c = queryChar(*text);
+            const NodeView node = nodeAt(currentNode);
+            auto keysEnd = node.keys + node.num;
+            auto keyIt = std::lower_bound(node.keys, keysEnd, c, KeyLess());
+            if (keyIt == keysEnd || *keyIt != c)
+                break;
+
+            // keys of the smaller entries come first
+            const size_t index = keyIt - node.keys;
+            for (size_t i = 0; i < index; ++i)
+                rank += node.counts[i];
+
+            currentNode = node.nodes[index];
+            ++text;
+            const bool codepointEnd = !utf8 || !utf8IsContinuation(*text);
+            if (currentNode == 0) {
+                if (codepointEnd)
+                    onStop(text, rank);
+                return;
+            }
+
+            auto nextKeyIt = keyIt + 1;
+            if (nextKeyIt != keysEnd && *keyIt == *nextKeyIt) {
+                if (codepointEnd && !onStop(text, rank))
+                    return;
+                rank++; // the stop precedes its subtree
+            }
+        }
+    }
+
+    struct PackedNode {
+        ScoreType maxScore = 0; // of the keys below the node
+        CountType numKeys = 0; // below the node, its own stop not included
+    };
+
+    // false if a node needs more entries than NumType counts (255 keys plus their stops)
+    bool packNode(const TrieNode& node, PackedNode& packed)
+    {
+        // make additional shift for duplicates
+        int duplicateShift = 0;
+        for (int i = 0; i < node.getSize(); ++i) {
+            const TrieNode* childNode = node.getNode(i);
+            if (childNode->getSize() != 0 && childNode->bStop)
+                duplicateShift++;
+        }
+
+        const size_t nodeSize = node.getSize();
+        const size_t layoutSize = nodeSize + duplicateShift;
+        if (layoutSize > std::numeric_limits<NumType>::max())
+            return false;
+
+        const size_t numStart = m_data.size();
+        const size_t keyStart = numStart + sizeof(NumType);
+        const size_t childNodeStart = nodesStart(keyStart, layoutSize);
+        const size_t scoreStart = childNodeStart + layoutSize * sizeof(IndexType);
+        const size_t countStart = scoreStart + ((m_flags & PackScores) ? layoutSize * sizeof(ScoreType) : 0);
+
+        m_data.resize(nodeEnd(numStart, layoutSize, m_flags));
+        assert((size_t)m_data.data() % 8 == 0);
+
+        NumType* numPacked = (NumType*)&m_data.at(numStart);
+        KeyType* packedKeys = (KeyType*)&m_data.at(keyStart);
+        // not at(), the arrays end the buffer and are empty for a node without children
+        IndexType* packedNodes = (IndexType*)(m_data.data() + childNodeStart);
+        ScoreType* packedScores = (m_flags & PackScores) ? (ScoreType*)(m_data.data() + scoreStart) : nullptr;
+        CountType* packedCounts = (m_flags & PackCounts) ? (CountType*)(m_data.data() + countStart) : nullptr;
+
+        *numPacked = nodeSize;
+
+        for (int I = 0, packedI = 0; I < nodeSize; ++I, ++packedI) {
+            const auto& childKey = node.getKey(I);
+            const auto& childNode = node.getNode(I);
+
+            packedKeys[packedI] = childKey;
+            packedNodes[packedI] = m_data.size();
+
+            childNode->dirty = false;
+            if (childNode->getSize() != 0) {
+                packedNodes[packedI] = m_data.size();
+                childNode->packedAt = m_data.size();
+                PackedNode child;
+                if (!packNode(*childNode, child))
+                    return false;
+                ScoreType childMax = child.maxScore;
+
+                // as data can be reallocated we should update pointers
+                numPacked = (NumType*)&m_data.at(numStart);
+                packedKeys = (KeyType*)&m_data.at(keyStart);
+                packedNodes = (IndexType*)&m_data.at(childNodeStart);
+                packedScores = packedScores ? (ScoreType*)&m_data.at(scoreStart) : nullptr;
+                packedCounts = packedCounts ? (CountType*)&m_data.at(countStart) : nullptr;
+
+                if (childNode->bStop)
+                    childMax = std::max(childMax, childNode->score);
+                if (packedScores)
+                    packedScores[packedI] = childMax;
+                if (packedCounts)
+                    packedCounts[packedI] = child.numKeys;
+                packed.maxScore = std::max(packed.maxScore, childMax);
+                packed.numKeys += child.numKeys;
+
+                if (childNode->bStop) {
+                    (*numPacked)++;
+                    packedKeys[++packedI] = childKey;
+                    packedNodes[packedI] = 0;
+                    if (packedScores)
+                        packedScores[packedI] = childNode->score;
+                    if (packedCounts)
+                        packedCounts[packedI] = 1;
+                    packed.numKeys++;
+                }
+
+            } else {
+                packedNodes[packedI] = 0;
+                childNode->packedAt = 0;
+                if (packedScores)
+                    packedScores[packedI] = childNode->score;
+                if (packedCounts)
+                    packedCounts[packedI] = 1;
+                packed.maxScore = std::max(packed.maxScore, childNode->score);
+                packed.numKeys++;
+            }
+        }
+        return true;
+    }
+
+    // key group at entry i of a node: the key, its stop and the subtree below it
+    struct KeyGroup {
+        bool present = false;
+        KeyType key = 0;
+        bool stop = false;
+        ScoreType score = 0; // of the stop
+        size_t child = 0; // 0 without subtree
+        size_t next = 0; // entry of the next group
+    };
+
+    static KeyGroup keyGroup(const NodeView& node, size_t i)
+    {
+        KeyGroup group;
+        group.present = true;
+        group.key = node.keys[i];
+        const bool duplicate = i + 1 < node.num && node.keys[i + 1] == group.key;
+        group.child = node.nodes[i];
+        group.stop = group.child == 0 || duplicate;
+        if (node.scores && group.stop)
+            group.score = node.scores[duplicate ? i + 1 : i];
+        group.next = i + (duplicate ? 2 : 1);
+        return group;
+    }
+
+    // Writes the result of combine() below node aNode of a and bNode of b, a null image is
+    // an absent side. offset is 0 if nothing below remains, except for the root.
+    bool combineNode(const BasicDenseTrie* a, size_t aNode, const BasicDenseTrie* b, size_t bNode, SetOperation op, bool isRoot,
+        IndexType& offset, PackedNode& packed)
+    {
+        const NodeView nodeA = a ? a->nodeAt(aNode) : NodeView {};
+        const NodeView nodeB = b ? b->nodeAt(bNode) : NodeView {};
+        std::vector<NodeEntry> entries;
+
+        for (size_t i = 0, j = 0; i < nodeA.num || j < nodeB.num;) {
+            KeyGroup groupA = i < nodeA.num ? keyGroup(nodeA, i) : KeyGroup {};
+            KeyGroup groupB = j < nodeB.num ? keyGroup(nodeB, j) : KeyGroup {};
+            if (groupA.present && groupB.present && groupA.key != groupB.key)
+                (KeyLess()(groupA.key, groupB.key) ? groupB : groupA) = KeyGroup {}; // the larger key waits
+            i = groupA.present ? groupA.next : i;
+            j = groupB.present ? groupB.next : j;
+
+            const KeyType key = groupA.present ? groupA.key : groupB.key;
+            bool stop = false;
+            ScoreType score = groupA.score;
+            size_t childA = groupA.child, childB = groupB.child;
+            switch (op) {
+            case SetOperation::Union:
+                stop = groupA.stop || groupB.stop;
+                score = groupB.stop ? groupB.score : groupA.score;
+                break;
+            case SetOperation::Intersection:
+                stop = groupA.stop && groupB.stop;
+                if (!childA || !childB)
+                    childA = childB = 0;
+                break;
+            case SetOperation::Difference:
+                stop = groupA.stop && !groupB.stop;
+                childB = childA ? childB : 0;
+                break;
+            }
+
+            IndexType childOffset = 0;
+            PackedNode below;
+            if ((childA || childB) && !combineNode(childA ? a : nullptr, childA, childB ? b : nullptr, childB, op, false, childOffset, below))
+                return false;
+
+            if (childOffset) {
+                const ScoreType childMax = stop ? std::max(below.maxScore, score) : below.maxScore;
+                entries.push_back({ key, childOffset, childMax, below.numKeys });
+                packed.maxScore = std::max(packed.maxScore, childMax);
+                packed.numKeys += below.numKeys;
+            }
+            if (stop) {
+                entries.push_back({ key, 0, score, 1 });
+                packed.maxScore = std::max(packed.maxScore, score);
+                packed.numKeys++;
+            }
+        }
+
+        offset = 0;
+        if (entries.empty() && !isRoot)
+            return true;
+        const size_t numStart = isRoot ? 0 : m_data.size();
+        if (!fitsNode(numStart, entries.size(), isRoot ? m_rootCapacity : std::numeric_limits<IndexType>::max()))
+            return false;
+        writeNode(numStart, entries);
+        offset = IndexType(numStart);
+        return true;
+    }
+
+    // an entry of a node being written, for the writers that collect a node before placing it
+    struct NodeEntry {
+        KeyType key;
+        IndexType node;
+        ScoreType score;
+        CountType count;
+    };
+
+    // a node of num entries at numStart can be written and ends before limit
+    bool fitsNode(size_t numStart, size_t num, size_t limit) const
+    {
+        return num <= std::numeric_limits<NumType>::max() && nodeEnd(numStart, num, m_flags) <= limit;
+    }
+
+    // at the end of the image or into a slot reserved for it
+    void writeNode(size_t numStart, const std::vector<NodeEntry>& entries)
+    {
+        const size_t num = entries.size();
+        const size_t end = nodeEnd(numStart, num, m_flags);
+        if (end > m_data.size())
+            m_data.resize(end);
+
+        uint8_t* data = m_data.data();
+        *(NumType*)(data + numStart) = NumType(num);
+        const size_t keyStart = numStart + sizeof(NumType);
+        KeyType* keys = (KeyType*)(data + keyStart);
+        IndexType* nodes = (IndexType*)(data + nodesStart(keyStart, num));
+        uint8_t* payload = (uint8_t*)(nodes + num);
+        ScoreType* scores = (m_flags & PackScores) ? (ScoreType*)payload : nullptr;
+        CountType* counts = (m_flags & PackCounts) ? (CountType*)(payload + (scores ? num * sizeof(ScoreType) : 0)) : nullptr;
+        memset(keys + num, 0, (uint8_t*)nodes - (uint8_t*)(keys + num)); // padding
+        for (size_t i = 0; i < num; ++i) {
+            keys[i] = entries[i].key;
+            nodes[i] = entries[i].node;
+            if (scores)
+                scores[i] = entries[i].score;
+            if (counts)
+                counts[i] = entries[i].count;
+        }
+    }
+
+    static bool readFile(const char* path, ImageBuffer& data)
+    {
+        FILE* f = fopen(path, "rb");
+        if (!f)
+            return false;
+
+        bool ok = fseek(f, 0, SEEK_END) == 0;
+        long size = ok ? ftell(f) : -1;
+        ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+        if (ok) {
+            data.resize(size);
+            ok = fread(data.data(), 1, size, f) == (size_t)size;
+        }
+        fclose(f);
+        return ok;
+    }
+
+    // keys and maximum score below a node of the image, from its entries
+    PackedNode packedAggregate(size_t numStart) const
+    {
+        const NodeView node = nodeAt(numStart);
+        PackedNode packed;
+        for (size_t i = 0; i < node.num; ++i) {
+            if (node.scores)
+                packed.maxScore = std::max(packed.maxScore, node.scores[i]);
+            if (node.counts)
+                packed.numKeys += node.counts[i];
+        }
+        return packed;
+    }
+
+    size_t subtreeBytes(size_t numStart) const
+    {
+        size_t bytes = 0;
+        std::string prefix;
+        forEachNode(numStart, prefix, [&](size_t start, const std::string&) { bytes += nodeEnd(start, nodeAt(start).num, m_flags) - start; });
+        return bytes;
+    }
+
+    // Writes a dirty node after its dirty children, the root at offset 0 and any other node at
+    // the end. false if the root doesn't fit its slot or the node can't be packed.
+    bool repackNode(const TrieNode& node, PackedNode& packed)
+    {
+        const bool isRoot = &node == m_packedRoot;
+
+        // old children that are gone or replaced by a new node, with everything below them
+        if (isRoot || node.packedAt != 0) {
+            const NodeView old = nodeAt(isRoot ? 0 : node.packedAt);
+            for (size_t i = 0; i < old.num; ++i) {
+                TrieNode* const* child = old.nodes[i] ? node.children.find(old.keys[i]) : nullptr;
+                if (old.nodes[i] && (!child || (*child)->packedAt != old.nodes[i]))
+                    m_garbage += subtreeBytes(old.nodes[i]);
+            }
+            if (!isRoot)
+                m_garbage += nodeEnd(node.packedAt, old.num, m_flags) - node.packedAt;
+        }
+
+        std::vector<NodeEntry> entries;
+        entries.reserve(node.getSize() + 1);
+
+        for (size_t i = 0; i < node.getSize(); ++i) {
+            const TrieNode& child = *node.getNode(i);
+            const KeyType key = node.getKey(i);
+            if (child.getSize() == 0) {
+                if (child.packedAt != 0 && child.dirty)
+                    m_garbage += subtreeBytes(child.packedAt); // was an inner node
+                child.packedAt = 0;
+                child.dirty = false;
+                entries.push_back({ key, 0, child.score, 1 });
+                packed.maxScore = std::max(packed.maxScore, child.score);
+                packed.numKeys++;
+                continue;
+            }
+
+            PackedNode below;
+            if (child.dirty) {
+                if (!repackNode(child, below))
+                    return false;
+            } else {
+                below = packedAggregate(child.packedAt);
+            }
+            const ScoreType childMax = child.bStop ? std::max(below.maxScore, child.score) : below.maxScore;
+            entries.push_back({ key, IndexType(child.packedAt), childMax, below.numKeys });
+            packed.maxScore = std::max(packed.maxScore, childMax);
+            packed.numKeys += below.numKeys;
+            if (child.bStop) {
+                entries.push_back({ key, 0, child.score, 1 });
+                packed.numKeys++;
+            }
+        }
+
+        const size_t numStart = isRoot ? 0 : m_data.size();
+        if (!fitsNode(numStart, entries.size(), isRoot ? m_rootCapacity : std::numeric_limits<IndexType>::max()))
+            return false;
+        writeNode(numStart, entries);
+
+        node.packedAt = isRoot ? m_imageId : IndexType(numStart);
+        node.dirty = false;
+        return true;
+    }
+};
+
+// 32-bit child offsets, images up to 4 GiB
+using DenseTrie = BasicDenseTrie<uint32_t>;
+// 64-bit child offsets for larger images, 4 more bytes per entry and 8-byte aligned offsets
+using WideDenseTrie = BasicDenseTrie<uint64_t>;
+
+#endif // TRIE_H
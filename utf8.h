@@ -0,0 +1,105 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <algorithm>
+#include <bit> // std::countr_zero
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "xid_continue.h"
+
+// UTF-8 decoding and identifier classes for DenseTrie's PackUtf8 mode. Malformed
+// sequences decode as U+FFFD one byte at a time, so any byte string can be scanned.
+
+constexpr char32_t utf8Replacement = 0xFFFD;
+
+inline bool utf8IsContinuation(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+// codepoint at p, len gets its number of bytes; reads no further than a NUL
+inline char32_t decodeUtf8(const char* p, int& len)
+{
+    const unsigned char lead = (unsigned char)p[0];
+    len = 1;
+    if (lead < 0x80)
+        return lead;
+
+    int extra;
+    char32_t cp, min;
+    if ((lead & 0xE0) == 0xC0) {
+        extra = 1, cp = lead & 0x1F, min = 0x80;
+    } else if ((lead & 0xF0) == 0xE0) {
+        extra = 2, cp = lead & 0x0F, min = 0x800;
+    } else if ((lead & 0xF8) == 0xF0) {
+        extra = 3, cp = lead & 0x07, min = 0x10000;
+    } else {
+        return utf8Replacement; // stray continuation or invalid lead
+    }
+
+    for (int i = 1; i <= extra; ++i) {
+        if (!utf8IsContinuation(p[i]))
+            return utf8Replacement;
+        cp = (cp << 6) | ((unsigned char)p[i] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return utf8Replacement; // overlong, out of range or surrogate
+    len = extra + 1;
+    return cp;
+}
+
+// codepoint that ends right before end, not looking before begin
+inline char32_t decodeUtf8Before(const char* begin, const char* end)
+{
+    const char* start = end - 1;
+    while (start > begin && end - start < 4 && utf8IsContinuation(*start))
+        --start;
+    int len;
+    const char32_t cp = decodeUtf8(start, len);
+    return start + len == end ? cp : utf8Replacement;
+}
+
+// XID_Continue, the identifier chars of UAX #31: letters, digits, marks and connectors
+inline bool isIdentCodepoint(char32_t cp)
+{
+    if (cp < 0x80)
+        return (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z') || (cp >= '0' && cp <= '9') || cp == '_';
+
+    auto it = std::upper_bound(std::begin(xidContinueRanges), std::end(xidContinueRanges), cp,
+        [](char32_t value, const char32_t(&range)[2]) { return value < range[0]; });
+    return it != std::begin(xidContinueRanges) && cp <= it[-1][1];
+}
+
+// Number of ASCII bytes before the first NUL or high-bit byte. With SSE2 it tests 16 bytes
+// per step with aligned loads, which never cross a page, so it may read past the NUL
+// within the same 16 bytes; that is why it opts out of AddressSanitizer.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((no_sanitize_address))
+#endif
+inline size_t asciiPrefixLength(const char* text)
+{
+    const char* p = text;
+#if defined(__SSE2__)
+    while (((uintptr_t)p & 15) != 0) {
+        if (*p == '\0' || (*p & 0x80))
+            return p - text;
+        ++p;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    while (true) {
+        const __m128i block = _mm_load_si128((const __m128i*)p);
+        // high bit set, or byte equal to NUL
+        const int stop = _mm_movemask_epi8(block) | _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+        if (stop)
+            return p - text + std::countr_zero((unsigned)stop);
+        p += 16;
+    }
+#else
+    while (*p != '\0' && !(*p & 0x80))
+        ++p;
+    return p - text;
+#endif
+}
+
+#endif // UTF8_H